@@ -0,0 +1,153 @@
+#ifndef OCEAN_AI_BATCHER_HPP_
+#define OCEAN_AI_BATCHER_HPP_
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "context.hpp"
+#include "common.hpp"
+
+namespace ocean_ai {
+
+	/* Dynamic batching for feature extraction.
+	 * Aligned faces of concurrent callers are collected until 'max_batch' faces
+	 * are pending or the oldest request waited 'max_wait_us', then they run as
+	 * one Center::forward and every caller gets back its own rows of features.
+	 * One worker per context keeps all recognition contexts busy.
+	 */
+	template <typename Context>
+	class Batcher
+	{
+		using Clock = std::chrono::steady_clock;
+
+	public:
+		Batcher(Executor<Context>& executor, int workers, int max_batch, int max_wait_us)
+			: executor_(executor),
+			max_batch_(max_batch),
+			max_wait_(std::chrono::microseconds(max_wait_us)),
+			pending_faces_(0),
+			stop_(false)
+		{
+			for (int i = 0; i < workers; ++i)
+				workers_.emplace_back(&Batcher::Run, this);
+		}
+
+		~Batcher()
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			cond_.notify_all();
+			for (auto& worker : workers_)
+				worker.join();
+		}
+
+		std::future<cv::Mat> Submit(std::vector<cv::Mat> faces)
+		{
+			Request request;
+			request.faces = std::move(faces);
+			request.arrival = Clock::now();
+			std::future<cv::Mat> features = request.features.get_future();
+			if (request.faces.empty()) {
+				request.features.set_value(cv::Mat());
+				return features;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			pending_faces_ += request.faces.size();
+			pending_.push_back(std::move(request));
+			lock.unlock();
+			cond_.notify_all();
+			return features;
+		}
+
+	private:
+		struct Request
+		{
+			std::vector<cv::Mat> faces;
+			std::promise<cv::Mat> features;
+			Clock::time_point arrival;
+		};
+
+		void Run()
+		{
+			while (true) {
+				std::vector<Request> batch;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					cond_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+					if (pending_.empty())
+						return;	// stopped and drained
+
+					Clock::time_point deadline = pending_.front().arrival + max_wait_;
+					cond_.wait_until(lock, deadline, [this] {
+						return stop_ || pending_faces_ >= max_batch_; });
+					// another worker may have taken the requests meanwhile
+					if (pending_.empty())
+						continue;
+
+					size_t num = 0;
+					while (!pending_.empty() && (batch.empty() ||
+						num + pending_.front().faces.size() <= max_batch_)) {
+						num += pending_.front().faces.size();
+						pending_faces_ -= pending_.front().faces.size();
+						batch.push_back(std::move(pending_.front()));
+						pending_.pop_front();
+					}
+				}
+				cond_.notify_all();
+				Forward(batch);
+			}
+		}
+
+		void Forward(std::vector<Request>& batch)
+		{
+			std::vector<cv::Mat> faces;
+			for (auto& request : batch)
+				faces.insert(faces.end(), request.faces.begin(), request.faces.end());
+
+			std::vector<cv::Mat> rows;
+			try {
+				executor_.Run([&](Context* context) {
+					if (!context->enable_recog_)
+						throw std::invalid_argument("recognition option is disable when call face extraction.");
+
+					// features own their data, requests share it through row views.
+					cv::Mat features = context->center()->forward(faces);
+					int row = 0;
+					for (auto& request : batch) {
+						int num = static_cast<int>(request.faces.size());
+						rows.push_back(features.rowRange(row, row + num));
+						row += num;
+					}
+				});
+			}
+			catch (...) {
+				for (auto& request : batch)
+					request.features.set_exception(std::current_exception());
+				return;
+			}
+
+			for (size_t i = 0; i < batch.size(); ++i)
+				batch[i].features.set_value(std::move(rows[i]));
+		}
+
+		Executor<Context>& executor_;
+		const size_t max_batch_;
+		const Clock::duration max_wait_;
+
+		std::mutex mutex_;
+		std::condition_variable cond_;
+		std::deque<Request> pending_;
+		size_t pending_faces_;
+		bool stop_;
+		std::vector<std::thread> workers_;
+	};
+
+} // ocean_ai
+
+#endif // OCEAN_AI_BATCHER_HPP_
@@ -0,0 +1,78 @@
+#include "candidates.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCEAN_AI_X86
+#include <immintrin.h>
+#endif
+
+namespace ocean_ai {
+
+	namespace {
+
+		typedef void (*ScanFunc)(const float* scores, int size, float threshold,
+			int base, std::vector<int>& indices);
+
+		void scanScalar(const float* scores, int size, float threshold,
+			int base, std::vector<int>& indices) {
+			for (int i = 0; i < size; ++i)
+				if (scores[i] >= threshold)
+					indices.push_back(base + i);
+		}
+
+#ifdef OCEAN_AI_X86
+		__attribute__((target("avx")))
+		void scanAvx(const float* scores, int size, float threshold,
+			int base, std::vector<int>& indices) {
+			int i = 0;
+			const __m256 thresh = _mm256_set1_ps(threshold);
+			for (; i + 8 <= size; i += 8) {
+				unsigned mask = _mm256_movemask_ps(
+					_mm256_cmp_ps(_mm256_loadu_ps(scores + i), thresh, _CMP_GE_OQ));
+				// most cells are background, skip them with one branch.
+				while (mask) {
+					indices.push_back(base + i + __builtin_ctz(mask));
+					mask &= mask - 1;
+				}
+			}
+			scanScalar(scores + i, size - i, threshold, base + i, indices);
+		}
+
+		__attribute__((target("sse2")))
+		void scanSse2(const float* scores, int size, float threshold,
+			int base, std::vector<int>& indices) {
+			int i = 0;
+			const __m128 thresh = _mm_set1_ps(threshold);
+			for (; i + 4 <= size; i += 4) {
+				unsigned mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(scores + i), thresh));
+				// most cells are background, skip them with one branch.
+				while (mask) {
+					indices.push_back(base + i + __builtin_ctz(mask));
+					mask &= mask - 1;
+				}
+			}
+			scanScalar(scores + i, size - i, threshold, base + i, indices);
+		}
+#endif
+
+		ScanFunc selectScan() {
+#ifdef OCEAN_AI_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx"))
+				return scanAvx;
+			if (__builtin_cpu_supports("sse2"))
+				return scanSse2;
+#endif
+			return scanScalar;
+		}
+
+		const ScanFunc scan = selectScan();
+
+	} // namespace
+
+	void ThresholdScan(const float* scores, const int size, const float threshold,
+		const int base, std::vector<int>& indices)
+	{
+		scan(scores, size, threshold, base, indices);
+	}
+
+} // ocean_ai
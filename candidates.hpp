@@ -0,0 +1,47 @@
+#ifndef OCEAN_AI_CANDIDATES_HPP_
+#define OCEAN_AI_CANDIDATES_HPP_
+
+#include <vector>
+
+#include "nms.hpp"
+
+namespace ocean_ai {
+
+	/* Append offsets of 'scores' at or above 'threshold' to 'indices',
+	 * in ascending order and shifted by 'base'. Compares four or eight
+	 * scores at a time with SSE2 or AVX, picked by the features of the
+	 * running CPU, and only touches the hits.
+	 */
+	void ThresholdScan(const float* scores, const int size, const float threshold,
+		const int base, std::vector<int>& indices);
+
+	/* P-Net candidates as a struct of arrays: boxes and scores ready for NMS,
+	 * and regressions x1, y1, x2, y2 of the same candidate at the same index.
+	 */
+	class CandidateBuffer {
+	public:
+		BoxBuffer boxes;
+		std::vector<float> reg_x1, reg_y1, reg_x2, reg_y2;
+		// scratch for offsets of candidates in the score map.
+		std::vector<int> indices;
+
+		void resize(size_t n) {
+			boxes.x1.resize(n);
+			boxes.y1.resize(n);
+			boxes.x2.resize(n);
+			boxes.y2.resize(n);
+			boxes.scores.resize(n);
+			reg_x1.resize(n);
+			reg_y1.resize(n);
+			reg_x2.resize(n);
+			reg_y2.resize(n);
+		}
+
+		size_t size() const {
+			return boxes.size();
+		}
+	};
+
+} // ocean_ai
+
+#endif // OCEAN_AI_CANDIDATES_HPP_
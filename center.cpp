@@ -1,97 +1,199 @@
 #include "center.hpp"
 
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCEAN_AI_X86
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 namespace ocean_ai {
 
 	namespace Merge {
+		/* Element-wise policies of mirror merge, scalar and vector forms. */
+		struct Add {
+			static float apply(float a, float b) { return a + b; }
+#ifdef OCEAN_AI_X86
+			__attribute__((target("sse2")))
+			static __m128 apply(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+			__attribute__((target("avx2")))
+			static __m256 apply(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+#endif
+#ifdef __ARM_NEON
+			static float32x4_t apply(float32x4_t a, float32x4_t b) { return vaddq_f32(a, b); }
+#endif
+		};
+		struct Max {
+			static float apply(float a, float b) { return std::max(a, b); }
+#ifdef OCEAN_AI_X86
+			__attribute__((target("sse2")))
+			static __m128 apply(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+			__attribute__((target("avx2")))
+			static __m256 apply(__m256 a, __m256 b) { return _mm256_max_ps(a, b); }
+#endif
+#ifdef __ARM_NEON
+			static float32x4_t apply(float32x4_t a, float32x4_t b) { return vmaxq_f32(a, b); }
+#endif
+		};
+		struct Min {
+			static float apply(float a, float b) { return std::min(a, b); }
+#ifdef OCEAN_AI_X86
+			__attribute__((target("sse2")))
+			static __m128 apply(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+			__attribute__((target("avx2")))
+			static __m256 apply(__m256 a, __m256 b) { return _mm256_min_ps(a, b); }
+#endif
+#ifdef __ARM_NEON
+			static float32x4_t apply(float32x4_t a, float32x4_t b) { return vminq_f32(a, b); }
+#endif
+		};
+
+		/* Merge of 'num' rows of 'len' floats, as Center::MergeFunc. */
+		typedef void (*Func)(const float* data, int num, int len, float* out);
+
 		/* direct as features without merge */
-		cv::Mat direct(caffe::Blob<float>* out) {
-			int num = out->num();
-			int len = out->channels();
-			const float* data = out->cpu_data();
-			return R(cv::Mat(num, len, CV_32FC1, const_cast<float*>(data)));
-		}
-		/* concatenate mirror features */
-		cv::Mat concat(caffe::Blob<float>* out) {
-			int num = out->num() / 2;
-			int len = out->channels() * 2;
-			const float* data = out->cpu_data();
-			return R(cv::Mat(num, len, CV_32FC1, const_cast<float*>(data)));
-		}
-		/* elem-wise add */
-		cv::Mat add(caffe::Blob<float>* out) {
-			int num = out->num() / 2;
-			int len = out->channels();
-			const float* data = out->cpu_data();
-			cv::Mat merged(num, len, CV_32FC1);
-			for (int i = 0; i < num; ++i) {
-				float* row = merged.ptr<float>(i);
-				for (int j = 0; j < len; ++j)
-					row[j] = data[2*i*len + j] + data[(2*i+1)*len + j];
+		void direct(const float* data, int num, int len, float* out) {
+			std::copy(data, data + num * len, out);
+		}
+		/* concatenate mirror features, already adjacent in the blob */
+		void concat(const float* data, int num, int len, float* out) {
+			std::copy(data, data + 2 * num * len, out);
+		}
+
+		/* elem-wise Op of face and mirrored face rows, the whole chunk in one
+		 * call so Op inlines into the loops.
+		 */
+		template <typename Op>
+		void pairsScalar(const float* data, int num, int len, float* out) {
+			for (int r = 0; r < num; ++r) {
+				const float* a = data + 2 * r * len;
+				const float* b = a + len;
+				float* o = out + r * len;
+				int i = 0;
+#ifdef __ARM_NEON
+				for (; i + 4 <= len; i += 4)
+					vst1q_f32(o + i, Op::apply(vld1q_f32(a + i), vld1q_f32(b + i)));
+#endif
+				for (; i < len; ++i)
+					o[i] = Op::apply(a[i], b[i]);
 			}
-			return R(merged);
-		}
-		/* elem-wise max */
-		cv::Mat max(caffe::Blob<float>* out) {
-			int num = out->num() / 2;
-			int len = out->channels();
-			const float* data = out->cpu_data();
-			cv::Mat merged(num, len, CV_32FC1);
-			for (int i = 0; i < num; ++i) {
-				float* row = merged.ptr<float>(i);
-				for (int j = 0; j < len; ++j)
-					row[j] = std::max(data[2*i*len + j], data[(2*i+1)*len + j]);
+		}
+
+#ifdef OCEAN_AI_X86
+		template <typename Op>
+		__attribute__((target("sse2")))
+		void pairsSse2(const float* data, int num, int len, float* out) {
+			for (int r = 0; r < num; ++r) {
+				const float* a = data + 2 * r * len;
+				const float* b = a + len;
+				float* o = out + r * len;
+				int i = 0;
+				for (; i + 4 <= len; i += 4)
+					_mm_storeu_ps(o + i, Op::apply(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+				for (; i < len; ++i)
+					o[i] = Op::apply(a[i], b[i]);
 			}
-			return R(merged);
-		}
-		/* elem-wise min */
-		cv::Mat min(caffe::Blob<float>* out) {
-			int num = out->num() / 2;
-			int len = out->channels();
-			const float* data = out->cpu_data();
-			cv::Mat merged(num, len, CV_32FC1);
-			for (int i = 0; i < num; ++i) {
-				float* row = merged.ptr<float>(i);
-				for (int j = 0; j < len; ++j)
-					row[j] = std::min(data[2*i*len + j], data[(2*i+1)*len + j]);
+		}
+
+		template <typename Op>
+		__attribute__((target("avx2")))
+		void pairsAvx2(const float* data, int num, int len, float* out) {
+			for (int r = 0; r < num; ++r) {
+				const float* a = data + 2 * r * len;
+				const float* b = a + len;
+				float* o = out + r * len;
+				int i = 0;
+				for (; i + 8 <= len; i += 8)
+					_mm256_storeu_ps(o + i, Op::apply(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+				for (; i < len; ++i)
+					o[i] = Op::apply(a[i], b[i]);
 			}
-			return R(merged);
+		}
+#endif
+
+		/* Kernel of a policy, picked once by the features of the running CPU. */
+		template <typename Op>
+		Func selectPairs() {
+#ifdef OCEAN_AI_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return pairsAvx2<Op>;
+			if (__builtin_cpu_supports("sse2"))
+				return pairsSse2<Op>;
+#endif
+			return pairsScalar<Op>;
 		}
 	}
 
-	std::function<cv::Mat(caffe::Blob<float>*)> Center::factory(const Center::C_Mirror& mirror) {
+	Center::MergeFunc Center::factory(const Center::C_Mirror& mirror) {
 		if (mirror.enable) {
 			if (mirror.mode == "concat")
 				return Merge::concat;
 			else if (mirror.mode == "add")
-				return Merge::add;
+				return Merge::selectPairs<Merge::Add>();
 			else if (mirror.mode == "max")
-				return Merge::max;
+				return Merge::selectPairs<Merge::Max>();
 			else // min
-				return Merge::min;
+				return Merge::selectPairs<Merge::Min>();
 		}
 		else
 			return Merge::direct;
 	}
 
-	void Center::setBatchSize(const int batch_size) {
-		caffe::Blob<float>* input_layer = net->input_blobs()[0];
-		std::vector<int> input_shape = input_layer->shape();
-		input_shape[0] = batch_size;
-		input_layer->Reshape(input_shape);
-		net->Reshape();
+	void Center::normalize(cv::Mat& features, int begin, int end) {
+		int len = features.cols;
+		for (int i = begin; i < end; ++i) {
+			float* row = features.ptr<float>(i);
+			float norm = std::sqrt(caffe::caffe_cpu_dot<float>(len, row, row));
+			if (norm > 0.0f)
+				caffe::caffe_scal<float>(len, 1.0f / norm, row);
+		}
 	}
 
-	Center::Center(const Center::C_Center& c_center) :
+	void Center::project(cv::Mat& features) {
+		// (x - mean) * E^T as one gemm, minus the projected mean per row.
+		int num = features.rows;
+		int len = features.cols;
+		int dims = pca.projection.rows;
+		cv::Mat projected(num, dims, CV_32FC1);
+		caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, num, dims, len,
+			1.0f, features.ptr<float>(), pca.projection.ptr<float>(),
+			0.0f, projected.ptr<float>());
+		for (int i = 0; i < num; ++i)
+			caffe::caffe_axpy<float>(dims, -1.0f, pca.bias.ptr<float>(), projected.ptr<float>(i));
+		features = R(projected);
+	}
+
+	Center::Center(const Center::C_Center& c_center, const Center* shared) :
 		mirror(c_center.mirror),
 		pca(c_center.pca),
-		ref_points(c_center.ref_points) {
+		ref_points(c_center.ref_points),
+		max_batch(c_center.max_batch),
+		normalized(c_center.normalize) {
 
-		/* Load the Net and Model. */
-		net = std::make_shared<caffe::Net<float>>(c_center.deploy, caffe::TEST);
-		net->CopyTrainedLayersFrom(c_center.model);
+		/* Load the Net and Model, or share the Model loaded by another Center. */
+		if (shared) {
+			net = shareNet(c_center.deploy, *shared->net);
+		}
+		else {
+			net = std::make_shared<caffe::Net<float>>(c_center.deploy, caffe::TEST);
+			net->CopyTrainedLayersFrom(c_center.model);
+			syncParams(*net);
+		}
 		caffe::Blob<float>* input_layer = net->input_blobs()[0];
 		face_size.height = input_layer->shape(2);
 		face_size.width = input_layer->shape(3);
+		aligner_ = Aligner(ref_points, face_size);
+		reserveBatch(*net, mirror.enable ? 2 * max_batch : max_batch);
+		// the caller aligns too, so one helper less than threads.
+		if (shared && shared->align_workers)
+			align_workers = shared->align_workers;
+		else if (c_center.align_threads > 1)
+			align_workers = std::make_shared<ThreadPool>(c_center.align_threads - 1);
 	}
 
 	float Center::similar(const cv::Mat& features) {
@@ -103,71 +205,175 @@ namespace ocean_ai {
 		return 0.5 + 0.5 * inp_ab / (sqrt(norm_a) * sqrt(norm_b));
 	}
 
-	void Center::feed(const cv::Mat &face, int id) {
-		/* Feed image into input batch blob. */
-		caffe::Blob<float>* input_layer = net->input_blobs()[0];
-		int channels = input_layer->channels();
-		int data_size = face_size.area() * channels;
-		/* head pointer */
-		float* input_data = input_layer->mutable_cpu_data() + id * data_size;
-		std::vector<cv::Mat> input_channels;
-		for (int i = 0; i < channels; ++i) {
-			cv::Mat channel(face_size.height, face_size.width, CV_32FC1, input_data);
-			input_channels.push_back(channel);
-			input_data += face_size.area();
-		}
-		/* Normalization: [0,255] -> [-1, 1] */
-		cv::Mat normed;
-		face.convertTo(normed, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
-		cv::split(normed, input_channels);
-	}
-
-	cv::Mat Center::forward(const std::vector<cv::Mat>& faces) {
-		int num = faces.size();
+	template <typename Fill>
+	cv::Mat Center::forwardChunks(const int num, Fill fill) {
 		if (num == 0)
 			return R(cv::Mat());
 		
-		if (mirror.enable) {
-			setBatchSize(num * 2);
-			cv::Mat mirror_face;
-			for (int i = 0; i < num; i++) {
-				feed(faces[i], 2 * i);
-				cv::flip(faces[i], mirror_face, 1);
-				feed(mirror_face, 2 * i + 1);
+		int data_size = net->input_blobs()[0]->count(1);
+		cv::Mat features;
+		for (int begin = 0; begin < num; begin += max_batch) {
+			// rows past 'n' of the bucket are stale and never read.
+			int n = std::min(max_batch, num - begin);
+			int bucket = batchBucket(n, max_batch);
+			reshapeBatch(*net, mirror.enable ? bucket * 2 : bucket);
+			float* input_data = net->input_blobs()[0]->mutable_cpu_data();
+			for (int i = 0; i < n; i++) {
+				if (mirror.enable)	// mirrored face right after the face
+					fill(begin + i, input_data + 2 * i * data_size,
+						input_data + (2 * i + 1) * data_size);
+				else
+					fill(begin + i, input_data + i * data_size, nullptr);
 			}
-		}
-		else { // mirror disable
-			setBatchSize(num);
-			for (int i = 0; i < num; i++)
-				feed(faces[i], i);
-		}
 
-		caffe::Blob<float>* out = net->Forward()[0];
+			caffe::Blob<float>* out = net->Forward()[0];
 
-		cv::Mat features = mirror.merge(out);
+			// merge straight from the output blob into rows of this chunk,
+			// normalized while hot unless PCA comes first.
+			int len = out->count(1);
+			if (features.empty())
+				features.create(num, mirror.concat ? 2 * len : len, CV_32FC1);
+			mirror.merge(out->cpu_data(), n, len, features.ptr<float>(begin));
+			if (normalized && !pca.enable)
+				normalize(features, begin, begin + n);
+		}
 		
 		if (pca.enable) {
-			features = pca.model.project(features);
+			project(features);
+			if (normalized)
+				normalize(features, 0, num);
 		}
 
 		return R(features);
 	}
 
+	cv::Mat Center::forward(const std::vector<cv::Mat>& faces) {
+		return forwardChunks(faces.size(), [&](int i, float* data, float* mirror_data) {
+			/* Normalization: [0,255] -> [-1, 1], written as channel planes */
+			const cv::Mat& face = faces[i];
+			Planar mirrored(mirror_data, face_size);
+			ResizeToPlanar(face, cv::Rect(0, 0, face.cols, face.rows), face_size,
+				Planar(data, face_size), kNormAlpha, kNormBeta,
+				mirror_data ? &mirrored : nullptr);
+		});
+	}
+
+	cv::Mat Center::extract(const cv::Mat& image, const std::vector<FPoints>& fpts) {
+		return forwardChunks(fpts.size(), [&](int i, float* data, float* mirror_data) {
+			Planar mirrored(mirror_data, face_size);
+			WarpToPlanar(image, aligner_.transform(fpts[i]), face_size, Planar(data, face_size),
+				kNormAlpha, kNormBeta, mirror_data ? &mirrored : nullptr);
+		});
+	}
+
 	cv::Mat Center::align(const cv::Mat& image, const FPoints& fpts) {
+		return aligner_.align(image, fpts);
+	}
+
+	std::vector<cv::Mat> Center::alignMany(const cv::Mat& image, const std::vector<FPoints>& fpts) {
+		return aligner_.alignMany(image, fpts, align_workers.get());
+	}
+
+	Aligner::Aligner(const FPoints& ref_points, const cv::Size& face_size) :
+		ref_points(ref_points),
+		face_size(face_size),
+		ref_mean(0.0f, 0.0f) {
+		for (auto& point : ref_points)
+			ref_mean += point;
+		ref_mean *= 1.0f / ref_points.size();
+		for (auto& point : ref_points)
+			ref_centered.push_back(point - ref_mean);
+	}
+
+	cv::Mat Aligner::transform(const FPoints& fpts) const {
+		if (fpts.size() != ref_points.size())
+			throw std::invalid_argument("facial points do not match reference points.");
+		int num = fpts.size();
+		cv::Point2f mean(0.0f, 0.0f);
+		for (auto& point : fpts)
+			mean += point;
+		mean *= 1.0f / num;
+
+		// minimize sum |[a -b; b a] * src + t - dst|^2 over centered points:
+		// a = sum(src . dst) / var, b = sum(src x dst) / var.
+		double var = 0.0, dot = 0.0, cross = 0.0;
+		for (int i = 0; i < num; ++i) {
+			double sx = fpts[i].x - mean.x;
+			double sy = fpts[i].y - mean.y;
+			double dx = ref_centered[i].x;
+			double dy = ref_centered[i].y;
+			var += sx * sx + sy * sy;
+			dot += sx * dx + sy * dy;
+			cross += sx * dy - sy * dx;
+		}
+		if (var < 1e-12)
+			throw std::invalid_argument("facial points are degenerate.");
+		double a = dot / var;
+		double b = cross / var;
+
+		cv::Mat tform(2, 3, CV_64F);
+		tform.at<double>(0, 0) = a;
+		tform.at<double>(0, 1) = -b;
+		tform.at<double>(0, 2) = ref_mean.x - (a * mean.x - b * mean.y);
+		tform.at<double>(1, 0) = b;
+		tform.at<double>(1, 1) = a;
+		tform.at<double>(1, 2) = ref_mean.y - (b * mean.x + a * mean.y);
+		return tform;
+	}
+
+	cv::Mat Aligner::align(const cv::Mat& image, const FPoints& fpts) const {
 		cv::Mat face;
-		cv::Mat tform = cv::estimateRigidTransform(fpts, ref_points, true);
-		if (tform.empty())
-			tform = cv::estimateRigidTransform(fpts, ref_points, false);
-		cv::warpAffine(image, face, tform, face_size);
+		cv::warpAffine(image, face, transform(fpts), face_size);
 		return face;
 	}
 
+	std::vector<cv::Mat> Aligner::alignMany(const cv::Mat& image,
+		const std::vector<FPoints>& fpts, ThreadPool* workers) const {
+		std::vector<cv::Mat> faces(fpts.size());
+		if (!workers || fpts.size() < 2) {
+			for (size_t i = 0; i < fpts.size(); ++i)
+				faces[i] = align(image, fpts[i]);
+			return faces;
+		}
+
+		// each thread takes the next face.
+		std::atomic<size_t> next(0);
+		auto run = [&] {
+			for (size_t i = next++; i < fpts.size(); i = next++)
+				faces[i] = align(image, fpts[i]);
+		};
+
+		std::vector<std::future<void> > helpers;
+		for (size_t i = 0; i < workers->Size() && i + 1 < fpts.size(); ++i)
+			helpers.push_back(workers->Submit(run));
+
+		std::exception_ptr error;
+		try {
+			run();
+		}
+		catch (...) {
+			error = std::current_exception();
+			next = fpts.size();
+		}
+		// helpers refer to locals, wait for all of them before leaving.
+		for (auto& helper : helpers)
+			helper.wait();
+		if (error)
+			std::rethrow_exception(error);
+		for (auto& helper : helpers)
+			helper.get();
+		return faces;
+	}
+
 	float Center::verify(const cv::Mat& image1, const FPoints& fpts1,
 	                     const cv::Mat& image2, const FPoints& fpts2) {
-		std::vector<cv::Mat> faces;
-		faces.push_back(R(align(image1, fpts1)));
-		faces.push_back(R(align(image2, fpts2)));
-		cv::Mat features = forward(faces);
+		const cv::Mat* images[2] = {&image1, &image2};
+		const FPoints* fpts[2] = {&fpts1, &fpts2};
+		cv::Mat features = forwardChunks(2, [&](int i, float* data, float* mirror_data) {
+			Planar mirrored(mirror_data, face_size);
+			WarpToPlanar(*images[i], aligner_.transform(*fpts[i]), face_size, Planar(data, face_size),
+				kNormAlpha, kNormBeta, mirror_data ? &mirrored : nullptr);
+		});
 		return similar(features);
 	}
 
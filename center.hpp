@@ -5,6 +5,9 @@
 #include <caffe/caffe.hpp>
 
 #include "config.hpp"
+#include "net_utils.hpp"
+#include "preprocess.hpp"
+#include "thread_pool.hpp"
 
 namespace ocean_ai {
 	// #define USE_OPENMP
@@ -13,6 +16,29 @@ namespace ocean_ai {
 	#define _NUM_THREADS 4
 	#endif
 
+	class Aligner {
+	 public:
+		Aligner() {}
+		Aligner(const FPoints& ref_points, const cv::Size& face_size);
+		// Similarity transform (scale, rotation, translation) mapping 'fpts'
+		// onto reference points, closed-form least squares of Umeyama.
+		cv::Mat transform(const FPoints& fpts) const;
+		// Align image with facial points.
+		cv::Mat align(const cv::Mat& image, const FPoints& fpts) const;
+		// Align faces of one image, spread over 'workers' if given.
+		std::vector<cv::Mat> alignMany(const cv::Mat& image,
+			const std::vector<FPoints>& fpts, ThreadPool* workers = nullptr) const;
+		// Size of aligned faces.
+		cv::Size size() const { return face_size; }
+
+	 private:
+		FPoints ref_points;
+		cv::Size face_size;
+		// mean of reference points and the points relative to it.
+		cv::Point2f ref_mean;
+		FPoints ref_centered;
+	};
+
 	class Center {
 	 public:
 		using C_Center = Config::Settings::Center;
@@ -21,40 +47,59 @@ namespace ocean_ai {
 
 		// Default constructor.
 		Center() {}
-		// Real constructor
-		Center(const C_Center& c_center);
+		// Real constructor, share trained weights of 'shared' if given.
+		Center(const C_Center& c_center, const Center* shared = nullptr);
 		// Cos similarity between two features.
 		float similar(const cv::Mat& features);
-		// Feed: wapper of warpInputLayer.
-		// feed image into Net's inpub batch blob with certain id .
-		void feed(const cv::Mat& face, int id);
 		// Forward multi-faces and get features.
 		cv::Mat forward(const std::vector<cv::Mat>& faces);
+		// Align and forward faces of one image, warping straight into the
+		// input blob, mirrored copies included.
+		cv::Mat extract(const cv::Mat& image, const std::vector<FPoints>& fpts);
 		// Align image with facial points.
 		cv::Mat align(const cv::Mat& image, const FPoints& fpts);
+		// Align faces of one image, on align_threads threads.
+		std::vector<cv::Mat> alignMany(const cv::Mat& image, const std::vector<FPoints>& fpts);
+		// Aligner usable without this Center, eg. in other threads.
+		const Aligner& aligner() const { return aligner_; }
+		// Helpers of alignMany, null with a single align thread.
+		std::shared_ptr<ThreadPool> alignWorkers() const { return align_workers; }
 		// Verify between two images
 		float verify(const cv::Mat& image1, const FPoints& fpts1,
 			const cv::Mat& image2, const FPoints& fpts2);
 
 	 private:
-		static std::function<cv::Mat(caffe::Blob<float>*)> factory(const C_Mirror& mirror);
-		// Set batch size of network.
-		void setBatchSize(const int batch_size);
+		// Merge 'num' rows of output blob 'data' into 'out', rows of 'len' floats
+		// are pairs of face and mirrored face if mirror is enabled. Picked once
+		// per policy and CPU, and called once per chunk with the op inlined.
+		typedef void (*MergeFunc)(const float* data, int num, int len, float* out);
+		static MergeFunc factory(const C_Mirror& mirror);
+		// L2 normalize rows ['begin', 'end') of features in place.
+		static void normalize(cv::Mat& features, int begin, int end);
+		// PCA projection of features as one gemm.
+		void project(cv::Mat& features);
+		// Forward 'num' faces in chunks of at most max_batch, fill(i, data, mirror_data)
+		// writes face i, and its mirrored copy unless 'mirror_data' is null.
+		template <typename Fill>
+		cv::Mat forwardChunks(const int num, Fill fill);
 
 		// config variables
 		std::shared_ptr<caffe::Net<float> > net;
 		struct Mirror {
 			bool enable;
-			std::function<cv::Mat(caffe::Blob<float>*)> merge;
+			bool concat;	// features twice as long
+			MergeFunc merge;
 			Mirror() {}
 			Mirror(const C_Mirror& c_mirror) :
-				enable(c_mirror.enable) {
-				merge = factory(c_mirror);
-			}
+				enable(c_mirror.enable),
+				concat(c_mirror.enable && c_mirror.mode == "concat"),
+				merge(factory(c_mirror)) {}
 		} mirror;
 		struct Pca {
 			bool enable;
 			cv::PCA model;
+			cv::Mat projection;	// eigenvectors, one per row
+			cv::Mat bias;	// mean * projection^T
 			Pca() {}
 			Pca(const C_Pca& c_pca) :
 				enable(c_pca.enable) {
@@ -63,12 +108,22 @@ namespace ocean_ai {
 					cv::FileStorage fs(c_pca.model, cv::FileStorage::READ);
 					model.read(fs.root());
 					fs.release();
+					// float eigenvectors and projected mean for project().
+					cv::Mat mean;
+					model.eigenvectors.convertTo(projection, CV_32FC1);
+					model.mean.convertTo(mean, CV_32FC1);
+					bias = mean * projection.t();
 				}
 			}
 		} pca;
 		FPoints ref_points;
+		int max_batch;	// faces per forward, more are forwarded in chunks
+		bool normalized;	// L2 normalize features
 		// tool variables
 		cv::Size face_size;
+		Aligner aligner_;
+		// helpers of alignMany, shared by Centers sharing weights.
+		std::shared_ptr<ThreadPool> align_workers;
 	};
 
 } // ocean_ai
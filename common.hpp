@@ -33,6 +33,21 @@ namespace ocean_ai {
 		}
 	};
 
+	/* Options of face detection. */
+	class DetectOptions {
+	public:
+		int max_faces;	// at most this many faces, 0 for all
+		bool largest;	// rank faces by size instead of score
+		float margin;	// added to each side of regions of interest, relative to their size
+		explicit DetectOptions(int max_faces = 0, bool largest = false, float margin = 0.2f)
+			: max_faces(max_faces),
+			largest(largest),
+			margin(margin) {
+		}
+		// Only the largest face, eg. for verification and enrollment.
+		static DetectOptions Largest() { return DetectOptions(1, true); }
+	};
+
 	/************************************************************************/
 	/*                         A Tool Timer                                 */
 	/************************************************************************/
@@ -19,7 +19,44 @@ namespace ocean_ai {
 		} options;
 
 		struct Settings {
-			int K_ctx_per_GPU;
+			std::string device;	// "gpu" or "cpu"
+			int K_ctx_per_GPU;	// contexts per GPU in gpu mode
+			int contexts;		// contexts in cpu mode
+			int workers;		// threads of asynchronous api, 0 for one per context
+			std::string execution;	// "pool" or "actor"
+			bool affinity;		// pin actor threads to cpus
+
+			struct Pools {
+				int detection;		// detection contexts, 0 for the default count
+				int recognition;	// recognition contexts, 0 for the default count
+				Pools() : detection(0), recognition(0) {}
+				Pools(const rapidjson::Value& v) :
+					detection(v["detection"].GetInt()),
+					recognition(v["recognition"].GetInt()) {}
+			} pools;
+
+			struct Pipeline {
+				bool enable;
+				int depth;		// jobs queued between two stages
+				int align_threads;
+				Pipeline() : enable(false), depth(1), align_threads(1) {}
+				Pipeline(const rapidjson::Value& v) :
+					enable(v["enable"].GetBool()),
+					depth(v["depth"].GetInt()),
+					align_threads(v["align_threads"].GetInt()) {
+					if (depth < 1 || align_threads < 1)
+						throw std::invalid_argument("Invalid pipeline in json config.");
+				}
+			} pipeline;
+
+			struct Admission {
+				bool enable;
+				int slo_ms;	// reject requests expected to queue longer
+				Admission() : enable(false), slo_ms(0) {}
+				Admission(const rapidjson::Value& v) :
+					enable(v["enable"].GetBool()),
+					slo_ms(v["slo_ms"].GetInt()) {}
+			} admission;
 
 			struct Glog {
 				int level;
@@ -36,6 +73,9 @@ namespace ocean_ai {
 				int min_size;
 				cv::Vec3f thresholds;
 				bool precise_landmark;
+				std::string pyramid;
+				int pyramid_threads;
+				cv::Vec3i max_batch;
 
 				struct Limitation {
 					bool enable;
@@ -55,7 +95,26 @@ namespace ocean_ai {
 					factor(v["factor"].GetFloat()),
 					min_size(v["min_size"].GetInt()),
 					precise_landmark(v["precise_landmark"].GetBool()),
+					pyramid("serial"),
+					pyramid_threads(4),
+					max_batch(128, 128, 128),
 					limitation(v["limitation"]) {
+					if (v.HasMember("pyramid"))
+						pyramid = v["pyramid"].GetString();
+					if (v.HasMember("pyramid_threads"))
+						pyramid_threads = v["pyramid_threads"].GetInt();
+					if (pyramid != "serial" && pyramid != "mosaic" && pyramid != "parallel")
+						throw std::invalid_argument("Unsupported pyramid of mtcnn in json config.");
+					if (pyramid_threads < 1)
+						throw std::invalid_argument("Invalid pyramid_threads of mtcnn in json config.");
+					if (v.HasMember("max_batch")) {
+						if (v["max_batch"].Capacity() < 3)
+							throw std::invalid_argument("max_batch are not enough in json config.");
+						for (int i = 0; i < 3; ++i)
+							max_batch[i] = v["max_batch"][i].GetInt();
+					}
+					if (max_batch[0] < 1 || max_batch[1] < 1 || max_batch[2] < 1)
+						throw std::invalid_argument("Invalid max_batch of mtcnn in json config.");
 					if (v["thresholds"].Capacity() < 3)
 						throw std::invalid_argument("thresholds are not enough in json config.");
 					thresholds = cv::Vec3f(
@@ -87,13 +146,38 @@ namespace ocean_ai {
 						enable(v["enable"].GetBool()),
 						model(v["model"].GetString()) {}
 				} pca;
+				struct Batching {
+					bool enable;
+					int max_batch;
+					int max_wait_us;
+					Batching() : enable(false), max_batch(1), max_wait_us(0) {}
+					Batching(const rapidjson::Value& v) :
+						enable(v["enable"].GetBool()),
+						max_batch(v["max_batch"].GetInt()),
+						max_wait_us(v["max_wait_us"].GetInt()) {
+						if (max_batch < 1 || max_wait_us < 0)
+							throw std::invalid_argument("Invalid batching in json config.");
+					}
+				} batching;
+				int max_batch;
+				int align_threads;
+				bool normalize;
 				FPoints ref_points;
 				Center() {}
 				Center(const rapidjson::Value& v) :
 					deploy(v["deploy"].GetString()),
 					model(v["model"].GetString()),
 					mirror(v["mirror"]),
-					pca(v["pca"]) {
+					pca(v["pca"]),
+					max_batch(v.HasMember("max_batch") ? v["max_batch"].GetInt() : 32),
+					align_threads(v.HasMember("align_threads") ? v["align_threads"].GetInt() : 1),
+					normalize(v.HasMember("normalize") ? v["normalize"].GetBool() : false) {
+					if (v.HasMember("batching"))
+						batching = Batching(v["batching"]);
+					if (max_batch < 1)
+						throw std::invalid_argument("Invalid max_batch of center in json config.");
+					if (align_threads < 1)
+						throw std::invalid_argument("Invalid align_threads of center in json config.");
 
 					for (int i = 0; i < 5; ++i) {
 						if (v["ref_points"].Capacity() < 10)
@@ -107,10 +191,26 @@ namespace ocean_ai {
 
 			Settings() {}
 			Settings(const rapidjson::Value& v) :
-				K_ctx_per_GPU(v["K_ctx_per_GPU"].GetInt()),
+				device(v.HasMember("device") ? v["device"].GetString() : "gpu"),
+				K_ctx_per_GPU(v.HasMember("K_ctx_per_GPU") ? v["K_ctx_per_GPU"].GetInt() : 1),
+				contexts(v.HasMember("contexts") ? v["contexts"].GetInt() : 1),
+				workers(v.HasMember("workers") ? v["workers"].GetInt() : 0),
+				execution(v.HasMember("execution") ? v["execution"].GetString() : "pool"),
+				affinity(v.HasMember("affinity") ? v["affinity"].GetBool() : false),
 				glog(v["glog"]),
 				mtcnn(v["mtcnn"]),
-				center(v["center"]) {}
+				center(v["center"]) {
+				if (v.HasMember("pools"))
+					pools = Pools(v["pools"]);
+				if (v.HasMember("pipeline"))
+					pipeline = Pipeline(v["pipeline"]);
+				if (v.HasMember("admission"))
+					admission = Admission(v["admission"]);
+				if (device != "gpu" && device != "cpu")
+					throw std::invalid_argument("Unsupported device in json config.");
+				if (execution != "pool" && execution != "actor")
+					throw std::invalid_argument("Unsupported execution in json config.");
+			}
 		} settings;
 
 		Config() {}
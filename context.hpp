@@ -1,13 +1,43 @@
 #ifndef OCEAN_AI_CONTEXT_HPP_
 #define OCEAN_AI_CONTEXT_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <mutex>
 #include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "ring_queue.hpp"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace ocean_ai {
 
+	typedef std::chrono::steady_clock::time_point Deadline;
+
+	/* Thrown when no context can run a request before its deadline. */
+	class DeadlineExceeded : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	/* Thrown by admission control when the estimated queueing delay exceeds the slo. */
+	class Overloaded : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
 	/* A simple threadsafe queue using a mutex and a condition variable. */
 	template <typename T>
 	class Queue
@@ -30,12 +60,34 @@ namespace ocean_ai {
 		}
 
 		T Pop()
+		{
+			T value;
+			PopUntil(value, Deadline::max());
+			return value;
+		}
+
+		/* Pop a value unless the queue stays empty until 'deadline'. */
+		bool PopUntil(T& value, Deadline deadline)
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
-			cond_.wait(lock, [this] {return !queue_.empty(); });
-			T value = std::move(queue_.front());
+			if (queue_.empty()) {
+				auto start = std::chrono::steady_clock::now();
+				++waits_;
+				max_waiters_ = std::max(max_waiters_, ++waiters_);
+				if (deadline == Deadline::max())
+					cond_.wait(lock, [this] {return !queue_.empty(); });
+				else
+					cond_.wait_until(lock, deadline, [this] {return !queue_.empty(); });
+				--waiters_;
+				wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count();
+				if (queue_.empty())
+					return false;
+			}
+			value = std::move(queue_.front());
 			queue_.pop();
-			return value;
+			++pops_;
+			return true;
 		}
 
 		size_t Size()
@@ -44,15 +96,44 @@ namespace ocean_ai {
 			return queue_.size();
 		}
 
+		size_t Capacity() const
+		{
+			return static_cast<size_t>(-1);
+		}
+
+		QueueStats Stats() const
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			QueueStats stats;
+			stats.pops = pops_;
+			stats.waits = waits_;
+			stats.wait_ns = wait_ns_;
+			stats.max_waiters = max_waiters_;
+			return stats;
+		}
+
 	private:
 		mutable std::mutex mutex_;
 		std::queue<T> queue_;
 		std::condition_variable cond_;
+		// counters, as kept by RingQueue.
+		uint64_t pops_ = 0;
+		uint64_t waits_ = 0;
+		uint64_t wait_ns_ = 0;
+		int waiters_ = 0;
+		int max_waiters_ = 0;
 	};
 
-	/* A pool of available contexts is simply implemented as a queue for our example. */
+	/* A pool of available contexts is a mutex queue, which keeps counters of
+	 * acquisitions and waits. Build with OCEAN_AI_RING_POOL for the lock-free
+	 * ring instead, test/bench_pool compares both on the target machine.
+	 */
 	template <typename Context>
+#ifdef OCEAN_AI_RING_POOL
+	using ContextPool = RingQueue<std::unique_ptr<Context>>;
+#else
 	using ContextPool = Queue<std::unique_ptr<Context>>;
+#endif
 
 	/* A RAII class for acquiring an execution context from a context pool. */
 	template <typename Context>
@@ -65,6 +146,14 @@ namespace ocean_ai {
 			context_->Activate();
 		}
 
+		ScopedContext(ContextPool<Context>& pool, Deadline deadline)
+			: pool_(pool)
+		{
+			if (!pool_.PopUntil(context_, deadline))
+				throw DeadlineExceeded("no context is available before deadline");
+			context_->Activate();
+		}
+
 		~ScopedContext()
 		{
 			context_->Deactivate();
@@ -76,11 +165,240 @@ namespace ocean_ai {
 			return context_.get();
 		}
 
+		Context* get() const
+		{
+			return context_.get();
+		}
+
 	private:
 		ContextPool<Context>& pool_;
 		std::unique_ptr<Context> context_;
 	};
 
+	/* Actors: every context is owned by one dedicated thread for its whole life,
+	 * activated once on it, and requests are posted to the threads through a
+	 * shared queue of tasks. Threads may be pinned to cpus.
+	 */
+	template <typename Context>
+	class ContextActors
+	{
+	public:
+		ContextActors() = default;
+
+		~ContextActors()
+		{
+			// an empty task stops one actor after the queued tasks are done.
+			for (size_t i = 0; i < threads_.size(); ++i)
+				tasks_.Push(std::function<void(Context*)>());
+			for (auto& thread : threads_)
+				thread.join();
+		}
+
+		/* Start an actor owning 'context', pinned to 'cpu' if it is not negative. */
+		void Add(std::unique_ptr<Context> context, int cpu = -1)
+		{
+			threads_.emplace_back(&ContextActors::Run, this, context.get(), cpu);
+			contexts_.push_back(std::move(context));
+		}
+
+		template <typename F>
+		auto Post(F f) -> std::future<decltype(f(static_cast<Context*>(nullptr)))>
+		{
+			using Result = decltype(f(static_cast<Context*>(nullptr)));
+			auto task = std::make_shared<std::packaged_task<Result(Context*)> >(std::move(f));
+			std::future<Result> result = task->get_future();
+			tasks_.Push([task](Context* context) { (*task)(context); });
+			return result;
+		}
+
+		size_t Size() const
+		{
+			return contexts_.size();
+		}
+
+	private:
+		void Run(Context* context, int cpu)
+		{
+#ifdef __linux__
+			if (cpu >= 0) {
+				cpu_set_t cpus;
+				CPU_ZERO(&cpus);
+				CPU_SET(cpu, &cpus);
+				pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+			}
+#endif
+			context->Activate();
+			while (std::function<void(Context*)> task = tasks_.Pop())
+				task(context);
+			context->Deactivate();
+		}
+
+		Queue<std::function<void(Context*)> > tasks_;
+		std::vector<std::unique_ptr<Context> > contexts_;
+		std::vector<std::thread> threads_;
+	};
+
+	/* Runs functions on contexts: either the calling thread borrows a context
+	 * from a pool, or the function is posted to the actors owning them.
+	 * Actors are pinned to cpus from 'first_cpu' on unless it is negative.
+	 * With a positive 'slo_us', requests whose estimated queueing delay
+	 * exceeds it are rejected at once with Overloaded.
+	 */
+	template <typename Context>
+	class Executor
+	{
+		using Clock = std::chrono::steady_clock;
+
+	public:
+		Executor(bool actors, int first_cpu = -1, int slo_us = 0)
+			: first_cpu_(first_cpu),
+			size_(0),
+			slo_ns_(slo_us * 1000LL),
+			in_flight_(0),
+			service_ns_(0)
+		{
+			if (actors)
+				actors_.reset(new ContextActors<Context>);
+		}
+
+		void Add(std::unique_ptr<Context> context)
+		{
+			if (!actors_) {
+				if (size_ == pool_.Capacity())
+					throw std::invalid_argument("too many contexts for the context pool");
+				pool_.Push(std::move(context));
+				++size_;
+				return;
+			}
+			int cpu = -1;
+			if (first_cpu_ >= 0) {
+				int cpus = std::thread::hardware_concurrency();
+				cpu = cpus > 0 ? (first_cpu_ + actors_->Size()) % cpus : -1;
+			}
+			actors_->Add(std::move(context), cpu);
+			++size_;
+		}
+
+		template <typename F>
+		auto Run(F f, Deadline deadline = Deadline::max())
+			-> decltype(f(static_cast<Context*>(nullptr)))
+		{
+			Admit();
+			InFlight in_flight(*this);
+			if (actors_) {
+				// the task owns the functor. One cancelled at deadline never runs it,
+				// a started one is waited for, since 'f' may refer to the caller.
+				struct State {
+					F f;
+					std::atomic<int> stage;
+					explicit State(F&& f) : f(std::move(f)), stage(kPending) {}
+				};
+				auto state = std::make_shared<State>(std::move(f));
+				Executor* self = this;
+				auto result = actors_->Post([state, self, deadline](Context* context) {
+					int pending = kPending;
+					if (!state->stage.compare_exchange_strong(pending, kStarted))
+						throw DeadlineExceeded("request is cancelled before start");
+					if (Clock::now() > deadline)
+						throw DeadlineExceeded("request is not started before deadline");
+					Timed timed(*self);
+					return state->f(context);
+				});
+				if (deadline != Deadline::max() &&
+					result.wait_until(deadline) == std::future_status::timeout) {
+					int pending = kPending;
+					if (state->stage.compare_exchange_strong(pending, kCancelled))
+						throw DeadlineExceeded("request is not started before deadline");
+				}
+				return result.get();
+			}
+
+			/* In this scope an execution context is acquired for inference and it
+			 * will be automatically released back to the context pool when
+			 * exiting this scope.
+			 */
+			if (deadline == Deadline::max()) {
+				ScopedContext<Context> context(pool_);
+				Timed timed(*this);
+				return f(context.get());
+			}
+			ScopedContext<Context> context(pool_, deadline);
+			Timed timed(*this);
+			return f(context.get());
+		}
+
+		/* Estimated time a new request waits for a context. */
+		Clock::duration Delay()
+		{
+			int contexts = static_cast<int>(Size());
+			int queued = in_flight_.load(std::memory_order_relaxed) + 1 - contexts;
+			if (queued <= 0 || contexts <= 0)
+				return Clock::duration::zero();
+			double rounds = static_cast<double>(queued) / contexts;
+			return std::chrono::nanoseconds(
+				static_cast<long long>(rounds * service_ns_.load(std::memory_order_relaxed)));
+		}
+
+		/* Number of contexts, busy or not. */
+		size_t Size() const
+		{
+			return size_;
+		}
+
+		/* Acquisition counters of the context pool, empty in actor mode. */
+		QueueStats Stats() const
+		{
+			return pool_.Stats();
+		}
+
+	private:
+		// stages of a task posted to actors.
+		enum { kPending, kStarted, kCancelled };
+
+		void Admit()
+		{
+			if (slo_ns_ <= 0)
+				return;
+			if (Delay() > std::chrono::nanoseconds(slo_ns_))
+				throw Overloaded("estimated queueing delay exceeds slo");
+		}
+
+		/* Counts requests waiting for or running on contexts. */
+		struct InFlight
+		{
+			Executor& executor;
+			explicit InFlight(Executor& e) : executor(e) {
+				executor.in_flight_.fetch_add(1, std::memory_order_relaxed);
+			}
+			~InFlight() {
+				executor.in_flight_.fetch_sub(1, std::memory_order_relaxed);
+			}
+		};
+
+		/* Updates moving average of service time, races only lose samples. */
+		struct Timed
+		{
+			Executor& executor;
+			Clock::time_point start;
+			explicit Timed(Executor& e) : executor(e), start(Clock::now()) {}
+			~Timed() {
+				long long sample = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					Clock::now() - start).count();
+				long long average = executor.service_ns_.load(std::memory_order_relaxed);
+				average = average == 0 ? sample : average + (sample - average) / 8;
+				executor.service_ns_.store(average, std::memory_order_relaxed);
+			}
+		};
+
+		int first_cpu_;
+		size_t size_;
+		const long long slo_ns_;
+		ContextPool<Context> pool_;
+		std::unique_ptr<ContextActors<Context> > actors_;
+		std::atomic<int> in_flight_;
+		std::atomic<long long> service_ns_;
+	};
+
 } // ocean_ai
 
 #endif // OCEAN_AI_CONTEXT_HPP_
\ No newline at end of file
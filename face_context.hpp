@@ -5,7 +5,9 @@
 #include "mtcnn.hpp"
 #include "center.hpp"
 
+#ifndef CPU_ONLY
 #include <cuda_runtime.h>
+#endif
 
 namespace ocean_ai {
 
@@ -13,9 +15,19 @@ namespace ocean_ai {
 	{
 	public:
 		friend ScopedContext<FaceContext>;
+		friend ContextActors<FaceContext>;
+
+		// Device id of contexts running caffe in CPU mode.
+		static const int kCpuDevice = -1;
 
 		static bool IsCompatible(int device)
 		{
+#ifdef CPU_ONLY
+			return device == kCpuDevice;
+#else
+			if (device == kCpuDevice)
+				return true;
+
 			cudaError_t st = cudaSetDevice(device);
 			if (st != cudaSuccess)
 				return false;
@@ -25,24 +37,41 @@ namespace ocean_ai {
 				return false;
 
 			return true;
+#endif
 		}
 
-		FaceContext(const Config& config, int device) :
+		// Networks held by a context.
+		enum Role {
+			kDetection = 1,		// Mtcnn
+			kRecognition = 2	// Center
+		};
+
+		/* A context on the same device as 'shared' reuses its trained weights,
+		 * caffe blobs keep the weights alive even after 'shared' is destroyed.
+		 */
+		FaceContext(const Config& config, int device,
+			int roles = kDetection | kRecognition, const FaceContext* shared = nullptr) :
 			device_(device),
-			enable_detect_(config.options.detection),
-			enable_recog_(config.options.recognition) {
-
-			cudaError_t st = cudaSetDevice(device_);
-			if (st != cudaSuccess)
-				throw std::invalid_argument("could not set CUDA device");
+			enable_detect_(config.options.detection && (roles & kDetection)),
+			enable_recog_(config.options.recognition && (roles & kRecognition)) {
 
+			setDevice();
 			caffe_context_.reset(new caffe::Caffe);
 			caffe::Caffe::Set(caffe_context_.get());
+			if (device_ == kCpuDevice)
+				caffe::Caffe::set_mode(caffe::Caffe::CPU);
+			else
+				caffe::Caffe::set_mode(caffe::Caffe::GPU);
+
+			if (shared && shared->device_ != device_)
+				throw std::invalid_argument("could not share weights across devices");
 
 			if (enable_detect_)
-				mtcnn_.reset(new Mtcnn(config.settings.mtcnn));
+				mtcnn_.reset(new Mtcnn(config.settings.mtcnn,
+					shared ? shared->mtcnn_.get() : nullptr));
 			if (enable_recog_)
-				center_.reset(new Center(config.settings.center));
+				center_.reset(new Center(config.settings.center,
+					shared ? shared->center_.get() : nullptr));
 
 			caffe::Caffe::Set(nullptr);
 		}
@@ -56,12 +85,28 @@ namespace ocean_ai {
 			return center_.get();
 		}
 
+		int device() const
+		{
+			return device_;
+		}
+
 	private:
-		void Activate()
+		void setDevice()
 		{
+			if (device_ == kCpuDevice)
+				return;
+#ifdef CPU_ONLY
+			throw std::invalid_argument("CUDA device is unavailable in CPU_ONLY build");
+#else
 			cudaError_t st = cudaSetDevice(device_);
 			if (st != cudaSuccess)
 				throw std::invalid_argument("could not set CUDA device");
+#endif
+		}
+
+		void Activate()
+		{
+			setDevice();
 			caffe::Caffe::Set(caffe_context_.get());
 		}
 
@@ -2,14 +2,57 @@
 
 namespace ocean_ai {
 
-	Mtcnn::Mtcnn(const Mtcnn::C_Mtcnn& c_mtcnn) :
+	// Above this many boxes, grid NMS pays off for crowds of P-Net candidates.
+	const size_t kGridNmsSize = 2048;
+
+#ifdef NORM_FARST
+	// sample is normalized before detection.
+	const float kInputAlpha = 1.0f;
+	const float kInputBeta = 0.0f;
+#else
+	const float kInputAlpha = kNormAlpha;
+	const float kInputBeta = kNormBeta;
+#endif // NORM_FARST
+
+	// Order faces by size or score as asked, and keep at most max_faces of them.
+	void rankFaces(std::vector<FaceInfo>& infos, const DetectOptions& options) {
+		if (options.largest)
+			std::stable_sort(infos.begin(), infos.end(), [](const FaceInfo& x, const FaceInfo& y) {
+				return (x.bbox[2] - x.bbox[0]) * (x.bbox[3] - x.bbox[1])
+					> (y.bbox[2] - y.bbox[0]) * (y.bbox[3] - y.bbox[1]); });
+		else
+			std::stable_sort(infos.begin(), infos.end(), [](const FaceInfo& x, const FaceInfo& y) {
+				return x.score > y.score; });
+		size_t max_faces = options.max_faces;
+		if (max_faces > 0 && infos.size() > max_faces)
+			infos.erase(infos.begin() + max_faces, infos.end());
+	}
+
+	// Region of a bbox in image, corners rounded to pixels.
+	inline cv::Rect cropRect(const BBox& bbox) {
+		return cv::Rect(cv::Point2f(bbox[0], bbox[1]), cv::Point2f(bbox[2], bbox[3]));
+	}
+
+	Mtcnn::Mtcnn(const Mtcnn::C_Mtcnn& c_mtcnn, const Mtcnn* shared) :
 		model_dir(c_mtcnn.model_dir),
 		factor(c_mtcnn.factor),
 		min_size(c_mtcnn.min_size),
 		thresholds(c_mtcnn.thresholds),
 		precise_landmark(c_mtcnn.precise_landmark),
+		pyramid(c_mtcnn.pyramid),
+		pyramid_threads(c_mtcnn.pyramid_threads),
+		max_batch(c_mtcnn.max_batch),
 		limitation(c_mtcnn.limitation) {
-		loadModels(model_dir);
+		if (shared)
+			shareModels(model_dir, *shared);
+		else
+			loadModels(model_dir);
+		reserveBatch(*Rnet, max_batch[0]);
+		reserveBatch(*Onet, max_batch[1]);
+		if (precise_landmark)
+			reserveBatch(*Lnet, max_batch[2]);
+		if (pyramid == "parallel")
+			initPyramidWorkers(model_dir, shared);
 	}
 
 	void Mtcnn::loadModels(const std::string& model_dir)
@@ -24,37 +67,53 @@ namespace ocean_ai {
 			Lnet = std::make_shared<caffe::Net<float>>(model_dir + "/det4.prototxt", caffe::TEST);
 			Lnet->CopyTrainedLayersFrom(model_dir + "/det4.caffemodel");
 		}
+		syncParams(*Pnet);
+		syncParams(*Rnet);
+		syncParams(*Onet);
+		if (precise_landmark)
+			syncParams(*Lnet);
 	}
 
-	void Mtcnn::setBatchSize(std::shared_ptr<caffe::Net<float>> net, const int batch_size)
+	void Mtcnn::shareModels(const std::string& model_dir, const Mtcnn& shared)
 	{
-		caffe::Blob<float>* input_layer = net->input_blobs()[0];
-		std::vector<int> input_shape = input_layer->shape();
-		input_shape[0] = batch_size;
-		input_layer->Reshape(input_shape);
-		net->Reshape();
+		if (precise_landmark && !shared.Lnet)
+			throw std::invalid_argument("shared mtcnn has no landmark network.");
+		Pnet = shareNet(model_dir + "/det1.prototxt", *shared.Pnet);
+		Rnet = shareNet(model_dir + "/det2.prototxt", *shared.Rnet);
+		Onet = shareNet(model_dir + "/det3.prototxt", *shared.Onet);
+		if (precise_landmark)
+			Lnet = shareNet(model_dir + "/det4.prototxt", *shared.Lnet);
 	}
 
-	std::vector<std::vector<cv::Mat> > Mtcnn::warpInputLayer(std::shared_ptr<caffe::Net<float>> net)
+	void Mtcnn::initPyramidWorkers(const std::string& model_dir, const Mtcnn* shared)
 	{
-		std::vector<std::vector<cv::Mat> > input_channals;
-		caffe::Blob<float>* input_layer = net->input_blobs()[0];
-		int width = input_layer->width();
-		int height = input_layer->height();
-		float* input_data = input_layer->mutable_cpu_data();
+		// the caller runs scales on Pnet too, so one clone less than threads.
+		for (int i = 1; i < pyramid_threads; ++i)
+			Pnet_clones.push_back(shareNet(model_dir + "/det1.prototxt", *Pnet));
+		if (shared && shared->pyramid_workers)
+			pyramid_workers = shared->pyramid_workers;
+		else if (pyramid_threads > 1)
+			pyramid_workers = std::make_shared<ThreadPool>(pyramid_threads - 1);
+	}
 
-		for (int i = 0; i < input_layer->num(); ++i)
+	template <typename Fill, typename Read>
+	void Mtcnn::forwardChunks(caffe::Net<float>& net, const int num, const int max_batch,
+		Fill fill, Read read)
+	{
+		for (int begin = 0; begin < num; begin += max_batch)
 		{
-			std::vector<cv::Mat> channals;
-			for (int j = 0; j < input_layer->channels(); ++j)
-			{
-				channals.emplace_back(height, width, CV_32FC1, input_data);
-				input_data += width * height;
-			}
-			input_channals.push_back(std::move(channals));
+			// rows past 'n' of the bucket are stale and never read.
+			int n = std::min(max_batch, num - begin);
+			reshapeBatch(net, batchBucket(n, max_batch));
+			caffe::Blob<float>* input_layer = net.input_blobs()[0];
+			float* input_data = input_layer->mutable_cpu_data();
+			for (int j = 0; j < n; ++j)
+				fill(begin + j, input_data + j * input_layer->count(1));
+
+			const std::vector<caffe::Blob<float>*>& out = net.Forward();
+			for (int j = 0; j < n; ++j)
+				read(begin + j, j, out);
 		}
-
-		return R(input_channals);
 	}
 
 	std::vector<float> Mtcnn::scalePyramid(const int height, const int width)
@@ -72,35 +131,64 @@ namespace ocean_ai {
 		return R(scales);
 	}
 
-	std::vector<Proposal> Mtcnn::getCandidates(
-		const float scale, const caffe::Blob<float>* scores, const caffe::Blob<float>* regs)
+	void Mtcnn::getCandidates(const float scale,
+		const caffe::Blob<float>* scores, const caffe::Blob<float>* regs,
+		CandidateBuffer& candidates, const cv::Rect& cells)
 	{
-		int stride = 2;
-		int cell_size = 12;
-		int output_width = regs->width();
-		int output_height = regs->height();
-		std::vector<Proposal> pros;
+		const int stride = 2;
+		const int cell_size = 12;
+		const int width = regs->width();
+		const int plane = regs->width() * regs->height();
+		cv::Rect rect = cells.area() > 0 ? cells : cv::Rect(0, 0, regs->width(), regs->height());
+
+		// scan raw rows of the face confidence plane.
+		const float* confs = scores->cpu_data() + scores->offset(0, 1);
+		std::vector<int>& indices = candidates.indices;
+		indices.clear();
+		for (int i = rect.y; i < rect.y + rect.height; ++i)
+			ThresholdScan(confs + i * width + rect.x, rect.width, thresholds[0],
+				i * width + rect.x, indices);
+
+		// gather boxes, scores and regressions of hits in bulk.
+		const float* reg_data = regs->cpu_data();
+		size_t num = indices.size();
+		candidates.resize(num);
+		BoxBuffer& boxes = candidates.boxes;
+		for (size_t k = 0; k < num; ++k) {
+			int idx = indices[k];
+			int j = idx % width - rect.x;
+			int i = idx / width - rect.y;
+			// bounding box
+			boxes.x1[k] = j * stride / scale;
+			boxes.y1[k] = i * stride / scale;
+			boxes.x2[k] = (j * stride + cell_size - 1) / scale + 1;
+			boxes.y2[k] = (i * stride + cell_size - 1) / scale + 1;
+			// face confidence
+			boxes.scores[k] = confs[idx];
+			// bbox regression
+			candidates.reg_x1[k] = reg_data[idx];
+			candidates.reg_y1[k] = reg_data[plane + idx];
+			candidates.reg_x2[k] = reg_data[2 * plane + idx];
+			candidates.reg_y2[k] = reg_data[3 * plane + idx];
+		}
+	}
 
-		for (int i = 0; i < output_height; ++i)
-			for (int j = 0; j < output_width; ++j)
-				if (scores->data_at(0, 1, i, j) >= thresholds[0])
-				{
-					// bounding box
-					BBox bbox;
-					bbox[0] = j * stride / scale;	// x1
-					bbox[1] = i * stride / scale;	// y1
-					bbox[2] = (j * stride + cell_size - 1) / scale + 1;	// x2
-					bbox[3] = (i * stride + cell_size - 1) / scale + 1;	// y2
-					// bbox regression
-					Reg reg(
-						regs->data_at(0, 0, i, j),	// reg_x1
-						regs->data_at(0, 1, i, j),	// reg_y1
-						regs->data_at(0, 2, i, j),	// reg_x2
-						regs->data_at(0, 3, i, j));	// reg_y2
-					// face confidence
-					float score = scores->data_at(0, 1, i, j);
-					pros.emplace_back(R(bbox), score, R(reg));
-				}
+	std::vector<Proposal> Mtcnn::suppressCandidates(const CandidateBuffer& candidates,
+		const float threshold)
+	{
+		const BoxBuffer& boxes = candidates.boxes;
+		std::vector<int> keep = boxes.size() > kGridNmsSize ?
+			GridNonMaximumSuppression<kIoU>(boxes, threshold) :
+			ocean_ai::NonMaximumSuppression<kIoU>(boxes, threshold);
+
+		std::vector<Proposal> pros;
+		pros.reserve(keep.size());
+		for (int k : keep)
+			pros.emplace_back(
+				BBox(boxes.x1[k], boxes.y1[k], boxes.x2[k], boxes.y2[k]),
+				boxes.scores[k],
+				Reg(candidates.reg_x1[k], candidates.reg_y1[k],
+					candidates.reg_x2[k], candidates.reg_y2[k]));
 
 		return R(pros);
 	}
@@ -111,48 +199,24 @@ namespace ocean_ai {
 		if (pros.size() <= 1)
 			return pros;
 
-		std::sort(pros.begin(), pros.end(),
-			// Lambda function: descending order by score.
-			[](const Proposal& x, const Proposal& y) -> bool { return x.score > y.score; });
+		BoxBuffer boxes;
+		boxes.reserve(pros.size());
+		for (auto& pro : pros)
+			boxes.push_back(pro.bbox, pro.score);
 
+		bool grid = pros.size() > kGridNmsSize;
+		std::vector<int> keep;
+		if (type == IoM)
+			keep = grid ? GridNonMaximumSuppression<kIoM>(boxes, threshold)
+				: ocean_ai::NonMaximumSuppression<kIoM>(boxes, threshold);
+		else
+			keep = grid ? GridNonMaximumSuppression<kIoU>(boxes, threshold)
+				: ocean_ai::NonMaximumSuppression<kIoU>(boxes, threshold);
 
 		std::vector<Proposal> nms_pros;
-		while (!pros.empty()) {
-			// select maximun candidates.
-			Proposal max = R(pros[0]);
-			pros.erase(pros.begin());
-			float max_area = (max.bbox[2] - max.bbox[0])
-				* (max.bbox[3] - max.bbox[1]);
-			// filter out overlapped candidates in the rest.
-			int idx = 0;
-			while (idx < pros.size()) {
-				// computer intersection.
-				float x1 = std::max(max.bbox[0], pros[idx].bbox[0]);
-				float y1 = std::max(max.bbox[1], pros[idx].bbox[1]);
-				float x2 = std::min(max.bbox[2], pros[idx].bbox[2]);
-				float y2 = std::min(max.bbox[3], pros[idx].bbox[3]);
-				float overlap = 0;
-				if (x1 < x2 && y1 < y2)
-				{
-					float inter = (x2 - x1) * (y2 - y1);
-					// computer denominator.
-					float outer;
-					float area = (pros[idx].bbox[2] - pros[idx].bbox[0])
-						* (pros[idx].bbox[3] - pros[idx].bbox[1]);
-					if (type == IoM)	// Intersection over Minimum
-						outer = std::min(max_area, area);
-					else	// Intersection over Union
-						outer = max_area + area - inter;
-					overlap = inter / outer;
-				}
-
-				if (overlap > threshold)	// erase overlapped candidate
-					pros.erase(pros.begin() + idx);
-				else
-					idx++;	// check next candidate
-			}
-			nms_pros.push_back(R(max));
-		}
+		nms_pros.reserve(keep.size());
+		for (int idx : keep)
+			nms_pros.push_back(R(pros[idx]));
 
 		return R(nms_pros);
 	}
@@ -207,52 +271,173 @@ namespace ocean_ai {
 		bbox[3] = y2;
 	}
 
-	cv::Mat Mtcnn::cropPadding(const cv::Mat& sample, const BBox& bbox)
+	std::vector<Proposal> Mtcnn::scaleProposals(std::shared_ptr<caffe::Net<float> > net,
+		const cv::Mat& sample, const float scale)
 	{
-		cv::Rect img_rect(0, 0, sample.cols, sample.rows);
-		cv::Rect crop_rect(cv::Point2f(bbox[0], bbox[1]), cv::Point2f(bbox[2], bbox[3]));
-		cv::Rect inter_on_sample = crop_rect & img_rect;
-		// shifting inter from image CS (coordinate system) to crop CS.
-		cv::Rect inter_on_crop = inter_on_sample - crop_rect.tl();
+		int height = static_cast<int>(std::ceil(sample.rows * scale));
+		int width = static_cast<int>(std::ceil(sample.cols * scale));
 
-		cv::Mat crop(crop_rect.size(), CV_32FC3, cv::Scalar(0.0));
-		sample(inter_on_sample).copyTo(crop(inter_on_crop));
+		// Reshape Net.
+		caffe::Blob<float>* input_layer = net->input_blobs()[0];
+		input_layer->Reshape(1, 3, height, width);
+		net->Reshape();
+
+		cv::Size size(width, height);
+		ResizeToPlanar(sample, cv::Rect(0, 0, sample.cols, sample.rows), size,
+			Planar(input_layer->mutable_cpu_data(), size), kInputAlpha, kInputBeta);
+		const std::vector<caffe::Blob<float>*>& out = net->Forward();
+		CandidateBuffer candidates;
+		getCandidates(scale, out[0], out[1], candidates);
 
-		return R(crop);
+		// intra scale nms
+		return suppressCandidates(candidates, 0.5f);
 	}
 
-	std::vector<BBox> Mtcnn::ProposalNetwork(const cv::Mat & sample)
+	std::vector<Proposal> Mtcnn::serialProposals(const cv::Mat& sample, const std::vector<float>& scales)
 	{
-		std::vector<float> scales = scalePyramid(sample.rows, sample.cols);
 		std::vector<Proposal> total_pros;
-
-		caffe::Blob<float>* input_layer = Pnet->input_blobs()[0];
 		for (float scale : scales)
 		{
-			int height = static_cast<int>(std::ceil(sample.rows * scale));
-			int width = static_cast<int>(std::ceil(sample.cols * scale));
-			cv::Mat img;
-			cv::resize(sample, img, cv::Size(width, height));
-#ifndef NORM_FARST
-			img.convertTo(img, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
-#endif // !NORM_FARST
-
-			// Reshape Net.
-			input_layer->Reshape(1, 3, height, width);
-			Pnet->Reshape();
-
-			std::vector<cv::Mat> channals = warpInputLayer(Pnet)[0];
-			cv::split(img, channals);
-			const std::vector<caffe::Blob<float>*> out = Pnet->Forward();
-			std::vector<Proposal> pros = getCandidates(scale, out[0], out[1]);
+			std::vector<Proposal> pros = scaleProposals(Pnet, sample, scale);
+			if (!pros.empty()) {
+				total_pros.insert(total_pros.end(), pros.begin(), pros.end());
+			}
+		}
+
+		return R(total_pros);
+	}
+
+	std::vector<Proposal> Mtcnn::parallelProposals(const cv::Mat& sample, const std::vector<float>& scales)
+	{
+		// kernels of one GPU serialize anyway, only CPU mode gains from threads.
+		if (!pyramid_workers || caffe::Caffe::mode() == caffe::Caffe::GPU)
+			return serialProposals(sample, scales);
+
+		// each thread takes the next scale on its own Pnet, largest scales first.
+		std::vector<std::vector<Proposal> > scale_pros(scales.size());
+		std::atomic<size_t> next(0);
+		auto run = [&](std::shared_ptr<caffe::Net<float> > net) {
+			for (size_t i = next++; i < scales.size(); i = next++)
+				scale_pros[i] = scaleProposals(net, sample, scales[i]);
+		};
+
+		caffe::Caffe* caller = &caffe::Caffe::Get();
+		std::vector<std::future<void> > helpers;
+		for (size_t i = 0; i < Pnet_clones.size() && i + 1 < scales.size(); ++i) {
+			std::shared_ptr<caffe::Net<float> > net = Pnet_clones[i];
+			helpers.push_back(pyramid_workers->Submit([&run, net, caller] {
+				caffe::Caffe::Set(caller);
+				run(net);
+				caffe::Caffe::Set(nullptr);
+			}));
+		}
+
+		std::exception_ptr error;
+		try {
+			run(Pnet);
+		}
+		catch (...) {
+			error = std::current_exception();
+			next = scales.size();
+		}
+		// helpers refer to locals, wait for all of them before leaving.
+		for (auto& helper : helpers)
+			helper.wait();
+		if (error)
+			std::rethrow_exception(error);
+		for (auto& helper : helpers)
+			helper.get();
+
+		std::vector<Proposal> total_pros;
+		for (auto& pros : scale_pros)
+			total_pros.insert(total_pros.end(), pros.begin(), pros.end());
+		return R(total_pros);
+	}
+
+	std::vector<Proposal> Mtcnn::mosaicProposals(const cv::Mat& sample, const std::vector<float>& scales)
+	{
+		std::vector<Proposal> total_pros;
+		if (scales.empty())
+			return total_pros;
+
+		// Levels are packed into shelves of the mosaic, largest first, at even
+		// offsets so the stride 2 output grid of every level starts on a cell.
+		// Cells whose 12x12 window crosses a level border are dropped.
+		const int stride = 2;
+		const int cell_size = 12;
+		const int gap = 2;
+		auto even = [](int v) { return (v + 1) & ~1; };
+		std::vector<cv::Rect> levels;
+		for (float scale : scales)
+			levels.emplace_back(0, 0,
+				static_cast<int>(std::ceil(sample.cols * scale)),
+				static_cast<int>(std::ceil(sample.rows * scale)));
+
+		int mosaic_width = levels[0].width;
+		if (levels.size() > 1)
+			mosaic_width = even(levels[0].width + gap) + levels[1].width;
+		int x = 0, y = 0, shelf_height = 0;
+		for (auto& level : levels) {
+			if (x > 0 && x + level.width > mosaic_width) {	// next shelf
+				y = even(y + shelf_height + gap);
+				x = 0;
+				shelf_height = 0;
+			}
+			level.x = x;
+			level.y = y;
+			x = even(x + level.width + gap);
+			shelf_height = std::max(shelf_height, level.height);
+		}
+		int mosaic_height = y + shelf_height;
+
+		// Reshape Net once for all scales.
+		caffe::Blob<float>* input_layer = Pnet->input_blobs()[0];
+		input_layer->Reshape(1, 3, mosaic_height, mosaic_width);
+		Pnet->Reshape();
+
+		// every level is written in place, gaps are zero.
+		float* input_data = input_layer->mutable_cpu_data();
+		std::fill(input_data, input_data + input_layer->count(), 0.0f);
+		cv::Rect whole(0, 0, sample.cols, sample.rows);
+		for (auto& level : levels)
+			ResizeToPlanar(sample, whole, level.size(),
+				Planar(input_data + level.y * mosaic_width + level.x,
+					mosaic_width, mosaic_width * mosaic_height),
+				kInputAlpha, kInputBeta);
+		const std::vector<caffe::Blob<float>*>& out = Pnet->Forward();
+
+		CandidateBuffer candidates;
+		for (size_t i = 0; i < levels.size(); ++i) {
+			const cv::Rect& level = levels[i];
+			if (level.width < cell_size || level.height < cell_size)
+				continue;
+			cv::Rect cells(level.x / stride, level.y / stride,
+				(level.width - cell_size) / stride + 1,
+				(level.height - cell_size) / stride + 1);
+			getCandidates(scales[i], out[0], out[1], candidates, cells);
 
 			// intra scale nms
-			pros = NonMaximumSuppression(pros, 0.5f, IoU);
+			std::vector<Proposal> pros = suppressCandidates(candidates, 0.5f);
 
 			if (!pros.empty()) {
 				total_pros.insert(total_pros.end(), pros.begin(), pros.end());
 			}
 		}
+
+		return R(total_pros);
+	}
+
+	std::vector<BBox> Mtcnn::ProposalNetwork(const cv::Mat & sample)
+	{
+		std::vector<float> scales = scalePyramid(sample.rows, sample.cols);
+		std::vector<Proposal> total_pros;
+		if (pyramid == "mosaic")
+			total_pros = mosaicProposals(sample, scales);
+		else if (pyramid == "parallel")
+			total_pros = parallelProposals(sample, scales);
+		else
+			total_pros = serialProposals(sample, scales);
+
 		// inter scale nms
 		total_pros = NonMaximumSuppression(total_pros, 0.7f, IoU);	
 		boxRegression(total_pros);
@@ -266,174 +451,352 @@ namespace ocean_ai {
 
 	std::vector<BBox> Mtcnn::RefineNetwork(const cv::Mat & sample, std::vector<BBox> & bboxes)
 	{
-		if (bboxes.empty())
-			return R(bboxes);
-
-		size_t num = bboxes.size();
-		square(bboxes);	// convert bbox to square
-		setBatchSize(Rnet, num);
-		std::vector<std::vector<cv::Mat> > input_channals = warpInputLayer(Rnet);
-		for (int i = 0; i < num; ++i)
+		std::vector<std::vector<BBox> > batch(1, R(bboxes));
+		return R(RefineNetwork(std::vector<cv::Mat>(1, sample), batch)[0]);
+	}
+
+	std::vector<std::vector<BBox> > Mtcnn::RefineNetwork(const std::vector<cv::Mat>& samples,
+		std::vector<std::vector<BBox> >& bboxes)
+	{
+		std::vector<std::vector<BBox> > results(samples.size());
+		// image and bbox of every input, candidates of all images are batched.
+		std::vector<std::pair<int, BBox*> > inputs;
+		for (size_t n = 0; n < samples.size(); ++n) {
+			square(bboxes[n]);	// convert bbox to square
+			for (auto& bbox : bboxes[n])
+				inputs.emplace_back(n, &bbox);
+		}
+		if (inputs.empty())
+			return results;
+
+		cv::Size size(24, 24);
+		std::vector<std::vector<Proposal> > pros(samples.size());
+		forwardChunks(*Rnet, inputs.size(), max_batch[0],
+			[&](int i, float* input_data) {
+				// crop out of image reads as zero padding.
+				ResizeToPlanar(samples[inputs[i].first], cropRect(*inputs[i].second), size,
+					Planar(input_data, size), kInputAlpha, kInputBeta);
+			},
+			[&](int i, int j, const std::vector<caffe::Blob<float>*>& out) {
+				caffe::Blob<float>* scores = out[0];
+				caffe::Blob<float>* regs = out[1];
+				float score = scores->data_at(j, 1, 0, 0);
+				if (score >= thresholds[1]) {
+					Reg reg(regs->data_at(j, 0, 0, 0),	// x1
+						regs->data_at(j, 1, 0, 0),	// y1
+						regs->data_at(j, 2, 0, 0),	// x2
+						regs->data_at(j, 3, 0, 0));	// y2
+					pros[inputs[i].first].emplace_back(R(*inputs[i].second), score, R(reg));
+				}
+			});
+
+		// scatter back by image.
+		for (size_t n = 0; n < samples.size(); ++n)
 		{
-			cv::Mat crop = cropPadding(sample, bboxes[i]);
-			cv::resize(crop, crop, cv::Size(24, 24));
-#ifndef NORM_FARST
-			crop.convertTo(crop, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
-#endif // NORM_FARST
-			cv::split(crop, input_channals[i]);
+			pros[n] = NonMaximumSuppression(pros[n], 0.7f, IoU);
+			boxRegression(pros[n]);
+
+			for (auto& pro : pros[n])
+				results[n].push_back(R(pro.bbox));
 		}
 
-		const std::vector<caffe::Blob<float>*> out = Rnet->Forward();
-		caffe::Blob<float>* scores = out[0];
-		caffe::Blob<float>* regs = out[1];
+		return R(results);
+	}
+
+	std::vector<FaceInfo> Mtcnn::OutputNetwork(const cv::Mat & sample, std::vector<BBox> & bboxes)
+	{
+		std::vector<std::vector<BBox> > batch(1, R(bboxes));
+		return R(OutputNetwork(std::vector<cv::Mat>(1, sample), batch)[0]);
+	}
 
-		std::vector<Proposal> pros;
-		for (int i = 0; i < num; ++i)
+	std::vector<std::vector<FaceInfo> > Mtcnn::OutputNetwork(const std::vector<cv::Mat>& samples,
+		std::vector<std::vector<BBox> >& bboxes)
+	{
+		std::vector<std::vector<FaceInfo> > results(samples.size());
+		// image and bbox of every input, candidates of all images are batched.
+		std::vector<std::pair<int, BBox*> > inputs;
+		for (size_t n = 0; n < samples.size(); ++n) {
+			square(bboxes[n]);	// convert bbox to square
+			for (auto& bbox : bboxes[n])
+				inputs.emplace_back(n, &bbox);
+		}
+		if (inputs.empty())
+			return results;
+
+		cv::Size size(48, 48);
+		std::vector<std::vector<Proposal> > pros(samples.size());
+		forwardChunks(*Onet, inputs.size(), max_batch[1],
+			[&](int i, float* input_data) {
+				// crop out of image reads as zero padding.
+				ResizeToPlanar(samples[inputs[i].first], cropRect(*inputs[i].second), size,
+					Planar(input_data, size), kInputAlpha, kInputBeta);
+			},
+			[&](int i, int j, const std::vector<caffe::Blob<float>*>& out) {
+				caffe::Blob<float>* fpts = out[0];
+				caffe::Blob<float>* scores = out[1];
+				caffe::Blob<float>* regs = out[2];
+				float score = scores->data_at(j, 1, 0, 0);
+				if (score >= thresholds[2]) {
+					BBox& bbox = *inputs[i].second;
+					Reg reg(regs->data_at(j, 0, 0, 0),	// x1
+						regs->data_at(j, 1, 0, 0),	// y1
+						regs->data_at(j, 2, 0, 0),	// x2
+						regs->data_at(j, 3, 0, 0));	//y2
+					// facial landmarks
+					FPoints fpt;
+					float width = bbox[2] - bbox[0];
+					float height = bbox[3] - bbox[1];
+					for (int k = 0; k < 5; k++)
+						fpt.emplace_back(
+						fpts->data_at(j, 2*k, 0, 0) * width + bbox[0],
+						fpts->data_at(j, 2*k+1, 0, 0) * height + bbox[1]);
+					pros[inputs[i].first].emplace_back(R(bbox), score, R(fpt), R(reg));
+				}
+			});
+
+		// scatter back by image.
+		for (size_t n = 0; n < samples.size(); ++n)
 		{
-			if (scores->data_at(i, 1, 0, 0) >= thresholds[1]) {
-				Reg reg(regs->data_at(i, 0, 0, 0),	// x1
-					regs->data_at(i, 1, 0, 0),	// y1
-					regs->data_at(i, 2, 0, 0),	// x2
-					regs->data_at(i, 3, 0, 0));	// y2
-				float score = scores->data_at(i, 1, 0, 0);
-				pros.emplace_back(R(bboxes[i]), score, R(reg));
-			}
+			pros[n] = NonMaximumSuppression(pros[n], 0.7f, IoM);
+			boxRegression(pros[n]);
+
+			for (auto& pro : pros[n])
+				results[n].emplace_back(R(pro.bbox), pro.score, R(pro.fpts));
 		}
 
-		pros = NonMaximumSuppression(pros, 0.7f, IoU);
-		boxRegression(pros);
+		return R(results);
+	}
 
-		bboxes.clear();
-		for (auto& pro : pros)
-			bboxes.push_back(R(pro.bbox));
+	void Mtcnn::LandmarkNetwork(const cv::Mat & sample,
+		std::vector<FaceInfo>& infos)
+	{
+		std::vector<std::vector<FaceInfo> > batch(1, R(infos));
+		LandmarkNetwork(std::vector<cv::Mat>(1, sample), batch);
+		infos = R(batch[0]);
+	}
 
-		return R(bboxes);
+	void Mtcnn::LandmarkNetwork(const std::vector<cv::Mat>& samples,
+		std::vector<std::vector<FaceInfo> >& infos)
+	{
+		// faces of all images in one batch.
+		std::vector<std::pair<const cv::Mat*, FaceInfo*> > faces;
+		for (size_t n = 0; n < samples.size(); ++n)
+			for (auto& info : infos[n])
+				faces.emplace_back(&samples[n], &info);
+		if (faces.empty())
+			return;
+
+		cv::Size size(24, 24);
+		cv::Mat patch_sizes(faces.size(), 5, CV_32S);
+		// Caffe output blobs are disordered.
+		static const int fpt_order[5] = {0, 3, 2, 1, 4};
+		forwardChunks(*Lnet, faces.size(), max_batch[2],
+			[&](int i, float* input_data) {
+				const cv::Mat& sample = *faces[i].first;
+				const FaceInfo& info = *faces[i].second;
+				float patchw = std::max(info.bbox[2] - info.bbox[0],
+					info.bbox[3] - info.bbox[1]);
+				float patchs = patchw * 0.25f;
+				for (int k = 0; k < 5; ++k)
+				{
+					BBox patch;
+					patch[0] = info.fpts[k].x - patchs * 0.5f;
+					patch[1] = info.fpts[k].y - patchs * 0.5f;
+					patch[2] = info.fpts[k].x + patchs * 0.5f;
+					patch[3] = info.fpts[k].y + patchs * 0.5f;
+					square(patch);
+					patch_sizes.at<int>(i, k) = patch[2] - patch[0];
+
+					// channels 3k, 3k+1, 3k+2 of the face are B, G, R of patch k.
+					ResizeToPlanar(sample, cropRect(patch), size,
+						Planar(input_data + 3 * k * size.area(), size),
+						kInputAlpha, kInputBeta);
+				}
+			},
+			[&](int i, int j, const std::vector<caffe::Blob<float>*>& out) {
+				FaceInfo& info = *faces[i].second;
+				// for every facial landmark
+				for (int k = 0; k < 5; ++k)
+				{
+					int patch_size = patch_sizes.at<int>(i, k);
+					caffe::Blob<float>* offs = out[fpt_order[k]];
+					float off_x = offs->data_at(j, 0, 0, 0) - 0.5;
+					float off_y = offs->data_at(j, 1, 0, 0) - 0.5;
+					// Dot not makeoffrge movement with relative offset > 0.35
+					if (std::fabs(off_x) <= 0.35 && std::fabs(off_y) <= 0.35)
+					{
+						info.fpts[k].x += off_x * patch_size;
+						info.fpts[k].y += off_y * patch_size;
+					}
+				}
+			});
 	}
 
-	std::vector<FaceInfo> Mtcnn::OutputNetwork(const cv::Mat & sample, std::vector<BBox> & bboxes)
+	std::vector<FaceInfo> Mtcnn::detect(const cv::Mat & sample)
 	{
-		std::vector<FaceInfo> infos;
-		if (bboxes.empty())
-			return infos;
+	#ifdef NORM_FARST
+		cv::Mat normed_sample;
+		sample.convertTo(normed_sample, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
+	#else
+		const cv::Mat& normed_sample = sample;
+	#endif // NORM_FARST	
 
-		size_t num = bboxes.size();
-		square(bboxes);	// convert bbox to square
+		std::vector<BBox> bboxes = ProposalNetwork(normed_sample);
+		bboxes = RefineNetwork(normed_sample, bboxes);
+		std::vector<FaceInfo> infos = OutputNetwork(normed_sample, bboxes);
+		if (precise_landmark)
+			LandmarkNetwork(normed_sample, infos);
+		return R(infos);
+	}
 
-		setBatchSize(Onet, num);
-		std::vector<std::vector<cv::Mat> > input_channals = warpInputLayer(Onet);
-		for (int i = 0; i < num; ++i)
-		{
-			cv::Mat crop = cropPadding(sample, bboxes[i]);
-			cv::resize(crop, crop, cv::Size(48, 48));
-#ifndef NORM_FARST
-			crop.convertTo(crop, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
-#endif // NORM_FARST
-			cv::split(crop, input_channals[i]);
+	std::vector<std::vector<FaceInfo> > Mtcnn::detect(const std::vector<cv::Mat>& samples)
+	{
+		std::vector<cv::Mat> normed_samples;
+		for (auto& sample : samples) {
+	#ifdef NORM_FARST
+			cv::Mat normed_sample;
+			sample.convertTo(normed_sample, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
+			normed_samples.push_back(R(normed_sample));
+	#else
+			normed_samples.push_back(sample);
+	#endif // NORM_FARST	
 		}
 
-		const std::vector<caffe::Blob<float>*> out = Onet->Forward();
-		caffe::Blob<float>* fpts = out[0];
-		caffe::Blob<float>* scores = out[1];
-		caffe::Blob<float>* regs = out[2];
+		// Pnet runs per image, later stages batch candidates of all images.
+		std::vector<std::vector<BBox> > bboxes;
+		for (auto& sample : normed_samples)
+			bboxes.push_back(ProposalNetwork(sample));
+		bboxes = RefineNetwork(normed_samples, bboxes);
+		std::vector<std::vector<FaceInfo> > infos = OutputNetwork(normed_samples, bboxes);
+		if (precise_landmark)
+			LandmarkNetwork(normed_samples, infos);
+		return R(infos);
+	}
 
-		std::vector<Proposal> pros;
-		for (int i = 0; i < num; ++i)
-		{
-			BBox& bbox = bboxes[i];
-			if (scores->data_at(i, 1, 0, 0) >= thresholds[2]) {
-				Reg reg(regs->data_at(i, 0, 0, 0),	// x1
-					regs->data_at(i, 1, 0, 0),	// y1
-					regs->data_at(i, 2, 0, 0),	// x2
-					regs->data_at(i, 3, 0, 0));	//y2
-				float score = scores->data_at(i, 1, 0, 0);
-				// facial landmarks
-				FPoints fpt;
-				float width = bbox[2] - bbox[0];
-				float height = bbox[3] - bbox[1];
-				for (int j = 0; j < 5; j++)
-					fpt.emplace_back(
-					fpts->data_at(i, 2*j, 0, 0) * width + bbox[0],
-					fpts->data_at(i, 2*j+1, 0, 0) * height + bbox[1]);
-				pros.emplace_back(R(bbox), score, R(fpt), R(reg));
-			}
+	std::vector<FaceInfo> Mtcnn::detect(const cv::Mat & sample, const DetectOptions& options)
+	{
+		if (options.max_faces <= 0) {
+			// no cap to stop early for, only the order may change.
+			std::vector<FaceInfo> infos = detect(sample);
+			if (options.largest)
+				rankFaces(infos, options);
+			return R(infos);
 		}
 
-		pros = NonMaximumSuppression(pros, 0.7f, IoM);
-		boxRegression(pros);
+	#ifdef NORM_FARST
+		cv::Mat normed_sample;
+		sample.convertTo(normed_sample, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
+	#else
+		const cv::Mat& normed_sample = sample;
+	#endif // NORM_FARST	
+
+		// candidates kept per wanted face in front of R-Net and O-Net.
+		const size_t max_faces = options.max_faces;
+		const size_t rnet_batch = 16 * max_faces;
+		const size_t onet_batch = 4 * max_faces;
 
-		for (auto& pro : pros)
-			infos.emplace_back(R(pro.bbox), pro.score, R(pro.fpts));
+		// coarse first: small scales find large faces.
+		std::vector<float> scales = scalePyramid(sample.rows, sample.cols);
+		std::reverse(scales.begin(), scales.end());
+		std::vector<FaceInfo> infos;
+		size_t begin = 0;
+		while (begin < scales.size() && infos.size() < max_faces) {
+			std::vector<Proposal> total_pros;
+			size_t end = begin;
+			for (; end < scales.size() && scales[end] < 2.0f * scales[begin]; ++end) {
+				std::vector<Proposal> pros = scaleProposals(Pnet, normed_sample, scales[end]);
+				total_pros.insert(total_pros.end(), pros.begin(), pros.end());
+			}
+			begin = end;
+
+			// inter scale nms, proposals come out best first.
+			total_pros = NonMaximumSuppression(total_pros, 0.7f, IoU);
+			boxRegression(total_pros);
+			std::vector<BBox> bboxes;
+			for (size_t k = 0; k < total_pros.size() && k < rnet_batch; ++k)
+				bboxes.push_back(R(total_pros[k].bbox));
+
+			bboxes = RefineNetwork(normed_sample, bboxes);
+			if (bboxes.size() > onet_batch)
+				bboxes.resize(onet_batch);
+			std::vector<FaceInfo> octave = OutputNetwork(normed_sample, bboxes);
+			for (auto& info : octave)
+				infos.push_back(R(info));
+
+			// a face may show up in two octaves.
+			BoxBuffer boxes;
+			for (auto& info : infos)
+				boxes.push_back(info.bbox, info.score);
+			std::vector<int> keep = ocean_ai::NonMaximumSuppression<kIoM>(boxes, 0.7f);
+			std::vector<FaceInfo> kept;
+			for (int k : keep)
+				kept.push_back(R(infos[k]));
+			infos = R(kept);
+		}
 
+		rankFaces(infos, options);
+		if (precise_landmark)
+			LandmarkNetwork(normed_sample, infos);
 		return R(infos);
 	}
 
-	void Mtcnn::LandmarkNetwork(const cv::Mat & sample,
-		std::vector<FaceInfo>& infos)
+	std::vector<cv::Rect> Mtcnn::mergeRegions(const std::vector<cv::Rect>& rois,
+		const cv::Rect& bounds, const float margin)
 	{
-		if (infos.empty())
-			return;
-
-		size_t num = infos.size();
-		setBatchSize(Lnet, num);
-		cv::Rect img_rect(0, 0, sample.cols, sample.rows);
-		std::vector<std::vector<cv::Mat> > input_channals = warpInputLayer(Lnet);
-		cv::Mat patch_sizes(num, 5, CV_32S);
-		for (int i = 0; i < num; ++i)
-		{
-			FaceInfo& info = infos[i];
-			float patchw = std::max(info.bbox[2] - info.bbox[0],
-				info.bbox[3] - info.bbox[1]);
-			float patchs = patchw * 0.25f;
-			for (int j = 0; j < 5; ++j)
-			{
-				BBox patch;
-				patch[0] = info.fpts[j].x - patchs * 0.5f;
-				patch[1] = info.fpts[j].y - patchs * 0.5f;
-				patch[2] = info.fpts[j].x + patchs * 0.5f;
-				patch[3] = info.fpts[j].y + patchs * 0.5f;
-				square(patch);
-				patch_sizes.at<int>(i, j) = patch[2] - patch[0];
-				
-				cv::Mat crop = cropPadding(sample, patch);
-				cv::resize(crop, crop, cv::Size(24, 24));
-#ifndef NORM_FARST
-				crop.convertTo(crop, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
-#endif // NORM_FARST
+		std::vector<cv::Rect> regions;
+		for (auto& roi : rois) {
+			int dx = static_cast<int>(std::ceil(roi.width * margin));
+			int dy = static_cast<int>(std::ceil(roi.height * margin));
+			cv::Rect region = cv::Rect(roi.x - dx, roi.y - dy, roi.width + 2 * dx, roi.height + 2 * dy) & bounds;
+			if (region.area() > 0)
+				regions.push_back(region);
+		}
 
-				// extract channels of certain patch
-				std::vector<cv::Mat> patch_channels;
-				patch_channels.push_back(input_channals[i][3 * j + 0]);	// B
-				patch_channels.push_back(input_channals[i][3 * j + 1]);	// G
-				patch_channels.push_back(input_channals[i][3 * j + 2]);	// R
-				cv::split(crop, patch_channels);
-			}
+		// replace overlapping pairs by their union until none is left.
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (size_t i = 0; i < regions.size() && !merged; ++i)
+				for (size_t j = i + 1; j < regions.size(); ++j)
+					if ((regions[i] & regions[j]).area() > 0) {
+						regions[i] |= regions[j];
+						regions.erase(regions.begin() + j);
+						merged = true;
+						break;
+					}
 		}
+		return R(regions);
+	}
 
-		const std::vector<caffe::Blob<float>*> out = Lnet->Forward();
+	std::vector<FaceInfo> Mtcnn::detect(const cv::Mat & sample, const std::vector<cv::Rect>& rois,
+		const DetectOptions& options)
+	{
+		std::vector<cv::Rect> regions = mergeRegions(rois,
+			cv::Rect(0, 0, sample.cols, sample.rows), options.margin);
 
-		// for every facial landmark
-		// Caffe output blobs are disordered.
-		std::vector<int> fpt_order = {0, 3, 2, 1, 4};
-		for (int j = 0; j < 5; ++j)
-		{
-			caffe::Blob<float>* offs = out[fpt_order[j]];
-			// for every face
-			for (int i = 0; i < num; ++i)
-			{
-				int patch_size = patch_sizes.at<int>(i,j);
-				float off_x = offs->data_at(i, 0, 0, 0) - 0.5;
-				float off_y = offs->data_at(i, 1, 0, 0) - 0.5;
-				// Dot not makeoffrge movement with relative offset > 0.35
-				if (std::fabs(off_x) <= 0.35 && std::fabs(off_y) <= 0.35)
-				{
-					infos[i].fpts[j].x += off_x * patch_size;
-					infos[i].fpts[j].y += off_y * patch_size;
+		std::vector<FaceInfo> infos;
+		for (auto& region : regions) {
+			// a view of the region, pixels around it read as zero padding.
+			std::vector<FaceInfo> found = detect(sample(region), options);
+			for (auto& info : found) {
+				info.bbox[0] += region.x;
+				info.bbox[1] += region.y;
+				info.bbox[2] += region.x;
+				info.bbox[3] += region.y;
+				for (auto& fpt : info.fpts) {
+					fpt.x += region.x;
+					fpt.y += region.y;
 				}
+				infos.push_back(R(info));
 			}
 		}
+
+		rankFaces(infos, options);
+		return R(infos);
 	}
 
-	std::vector<FaceInfo> Mtcnn::detect(const cv::Mat & sample)
+	std::vector<FaceInfo> Mtcnn::track(const cv::Mat & sample,
+		const std::vector<FaceInfo>& faces, const float margin)
 	{
 	#ifdef NORM_FARST
 		cv::Mat normed_sample;
@@ -442,7 +805,13 @@ namespace ocean_ai {
 		const cv::Mat& normed_sample = sample;
 	#endif // NORM_FARST	
 
-		std::vector<BBox> bboxes = ProposalNetwork(normed_sample);
+		std::vector<BBox> bboxes;
+		for (auto& face : faces) {
+			const BBox& bbox = face.bbox;
+			float dx = (bbox[2] - bbox[0]) * margin;
+			float dy = (bbox[3] - bbox[1]) * margin;
+			bboxes.emplace_back(bbox[0] - dx, bbox[1] - dy, bbox[2] + dx, bbox[3] + dy);
+		}
 		bboxes = RefineNetwork(normed_sample, bboxes);
 		std::vector<FaceInfo> infos = OutputNetwork(normed_sample, bboxes);
 		if (precise_landmark)
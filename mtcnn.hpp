@@ -5,6 +5,10 @@
 #include <caffe/caffe.hpp>
 
 #include "config.hpp"
+#include "net_utils.hpp"
+#include "candidates.hpp"
+#include "preprocess.hpp"
+#include "thread_pool.hpp"
 
 namespace ocean_ai {
 
@@ -40,19 +44,29 @@ namespace ocean_ai {
 
 		// Default constructor.
 		Mtcnn() {};
-		// Real constructor
-		Mtcnn(const C_Mtcnn& c_mtcnn);
+		// Real constructor, share trained weights of 'shared' if given.
+		Mtcnn(const C_Mtcnn& c_mtcnn, const Mtcnn* shared = nullptr);
 		// Init four networks and load trained weights.
 		void loadModels(const std::string& model_dir);
-		// Set batch size of network.
-		void setBatchSize(std::shared_ptr<caffe::Net<float> > net, const int batch_size);
-		// Warp whole input layer into cv::Mat channels.
-		std::vector<std::vector<cv::Mat> > warpInputLayer(std::shared_ptr<caffe::Net<float> > net);
+		// Init four networks sharing trained weights with another Mtcnn.
+		void shareModels(const std::string& model_dir, const Mtcnn& shared);
+		// Init Pnet clones and workers of parallel pyramid, workers are shared with 'shared'.
+		void initPyramidWorkers(const std::string& model_dir, const Mtcnn* shared);
+		// Forward 'num' inputs through 'net' in chunks of at most 'max_batch':
+		// fill(i, data) writes input i, read(i, j, outputs) reads it at row j.
+		template <typename Fill, typename Read>
+		void forwardChunks(caffe::Net<float>& net, const int num, const int max_batch,
+			Fill fill, Read read);
 		// Create scale pyramid: down order
 		std::vector<float> scalePyramid(const int height, const int width);
-		// Get bboxes from maps of confidences and regressions.
-		std::vector<Proposal> getCandidates(const float scale,
-			const caffe::Blob<float>* regs, const caffe::Blob<float>* scores);
+		// Get bboxes from maps of confidences and regressions,
+		// only from 'cells' of the maps if given.
+		void getCandidates(const float scale,
+			const caffe::Blob<float>* scores, const caffe::Blob<float>* regs,
+			CandidateBuffer& candidates, const cv::Rect& cells = cv::Rect());
+		// Intra scale NMS, only kept candidates become proposals.
+		std::vector<Proposal> suppressCandidates(const CandidateBuffer& candidates,
+			const float threshold);
 		// Non Maximum Supression with type 'IoU' or 'IoM'.
 		std::vector<Proposal> NonMaximumSuppression(std::vector<Proposal>& pros,
 			const float threshold, const NMS_TYPE type);
@@ -62,9 +76,15 @@ namespace ocean_ai {
 		void square(std::vector<BBox> & bboxes);
 		void square(BBox & bbox);
 
-		// Crop proposals with padding 0.
-		cv::Mat cropPadding(const cv::Mat& sample, const BBox& bbox);
-
+		// Stage 1 of one scale on 'net'.
+		std::vector<Proposal> scaleProposals(std::shared_ptr<caffe::Net<float> > net,
+			const cv::Mat& sample, const float scale);
+		// Stage 1 of each scale by its own forward.
+		std::vector<Proposal> serialProposals(const cv::Mat& sample, const std::vector<float>& scales);
+		// Stage 1 of scales spread over Pnet clones on pyramid workers.
+		std::vector<Proposal> parallelProposals(const cv::Mat& sample, const std::vector<float>& scales);
+		// Stage 1 of all scales packed into one mosaic and one forward.
+		std::vector<Proposal> mosaicProposals(const cv::Mat& sample, const std::vector<float>& scales);
 		// Stage 1: Pnet get proposal bounding boxes
 		std::vector<BBox> ProposalNetwork(const cv::Mat& sample);
 		// Stage 2: Rnet refine and reject proposals
@@ -73,9 +93,34 @@ namespace ocean_ai {
 		std::vector<FaceInfo> OutputNetwork(const cv::Mat& sample, std::vector<BBox>& bboxes);
 		// Stage 4: Lnet refine facial landmarks
 		void LandmarkNetwork(const cv::Mat& sample, std::vector<FaceInfo>& infos);
+		// Stages 2-4 over several images: one batch for 'bboxes' or 'infos' of
+		// all images, results are per image in the same order as 'samples'.
+		std::vector<std::vector<BBox> > RefineNetwork(const std::vector<cv::Mat>& samples,
+			std::vector<std::vector<BBox> >& bboxes);
+		std::vector<std::vector<FaceInfo> > OutputNetwork(const std::vector<cv::Mat>& samples,
+			std::vector<std::vector<BBox> >& bboxes);
+		void LandmarkNetwork(const std::vector<cv::Mat>& samples,
+			std::vector<std::vector<FaceInfo> >& infos);
 
-		// Detect faces from images
+		// Detect faces from BGR images, 8-bit or float.
 		std::vector<FaceInfo> detect(const cv::Mat & sample);
+		// Detect faces of several images, sharing R/O/L-Net batches.
+		std::vector<std::vector<FaceInfo> > detect(const std::vector<cv::Mat>& samples);
+		// Detect at most 'max_faces' faces: walk the pyramid from coarse to fine
+		// an octave at a time, with R-Net/O-Net on the best candidates only,
+		// and stop once enough faces are found. Pyramid modes are not used.
+		std::vector<FaceInfo> detect(const cv::Mat & sample, const DetectOptions& options);
+		// Detect faces only inside regions of interest enlarged by options.margin,
+		// overlapping regions are merged first. Results are in image coordinates.
+		std::vector<FaceInfo> detect(const cv::Mat & sample, const std::vector<cv::Rect>& rois,
+			const DetectOptions& options);
+		// Enlarge regions by 'margin', clip them to 'bounds' and merge overlapping ones.
+		static std::vector<cv::Rect> mergeRegions(const std::vector<cv::Rect>& rois,
+			const cv::Rect& bounds, const float margin);
+		// Detect faces near known ones, eg. of the last video frame:
+		// skip Pnet and run the rest on bboxes enlarged by 'margin' per side.
+		std::vector<FaceInfo> track(const cv::Mat & sample,
+			const std::vector<FaceInfo>& faces, const float margin);
 	
 	 private:
 		// configures 
@@ -84,12 +129,18 @@ namespace ocean_ai {
 		int min_size;
 		cv::Vec3f thresholds;
 		bool precise_landmark;
+		std::string pyramid;
+		int pyramid_threads;
+		cv::Vec3i max_batch;	// of Rnet, Onet and Lnet
 		Limitation limitation;
 		// networks
 		std::shared_ptr<caffe::Net<float> > Pnet;
 		std::shared_ptr<caffe::Net<float> > Rnet;
 		std::shared_ptr<caffe::Net<float> > Onet;
 		std::shared_ptr<caffe::Net<float> > Lnet;
+		// parallel pyramid
+		std::vector<std::shared_ptr<caffe::Net<float> > > Pnet_clones;
+		std::shared_ptr<ThreadPool> pyramid_workers;
 	};
 
 } // ocean_ai
@@ -1,44 +1,155 @@
 #include <caffe/caffe.hpp>  //? Why must include guy!
 #include "native_api.hpp"
 #include "face_context.hpp"
+#include "batcher.hpp"
+#include "thread_pool.hpp"
+#include "pipeline.hpp"
 
 #include <iostream>
+#include <memory>
+#include <mutex>
 using namespace std;
 
 namespace ocean_ai {
 
-ContextPool<FaceContext> pool;
+	/* Everything built from one config. The engine in use is swapped atomically
+	 * by ReloadEngine, requests keep a reference to the engine they started on.
+	 */
+	struct Engine {
+		// Independent pools: contexts holding only Mtcnn, and contexts holding only Center.
+		std::unique_ptr<Executor<FaceContext> > detector;
+		std::unique_ptr<Executor<FaceContext> > recognizer;
+		// Context-free copy of the recognition aligner and its helpers, set with 'recognizer'.
+		Aligner aligner;
+		std::shared_ptr<ThreadPool> align_workers;
+		// Members are destroyed bottom-up: pending jobs drain before contexts go.
+		std::unique_ptr<Batcher<FaceContext> > batcher;
+		std::unique_ptr<Pipeline> pipeline;
+	};
+
+std::shared_ptr<Engine> current_engine;
+std::unique_ptr<ThreadPool> workers;
+std::once_flag logging_flag;
+
+	cv::Mat format(const cv::Mat& image);
+	std::unique_ptr<Pipeline> buildPipeline(Engine& engine, const Config::Settings::Pipeline& c_pipeline);
+
+	/* Ids of usable devices, kCpuDevice in cpu mode. */
+	std::vector<int> devices(const Config& config) {
+		std::vector<int> ids;
+		if (config.settings.device == "cpu") {
+			ids.push_back(FaceContext::kCpuDevice);
+			return ids;
+		}
+#ifdef CPU_ONLY
+		throw std::invalid_argument("gpu device is not supported in CPU_ONLY build");
+#else
+		int device_count;
+		cudaError_t st = cudaGetDeviceCount(&device_count);
+		if (st != cudaSuccess)
+			throw std::invalid_argument("could not list CUDA devices");
+
+		for (int dev = 0; dev < device_count; ++dev) {
+			if (!FaceContext::IsCompatible(dev)) {
+				LOG(ERROR) << "Skipping device: " << dev;
+				continue;
+			}
+			ids.push_back(dev);
+		}
+		return ids;
+#endif
+	}
+
+	/* Build an executor of 'count' contexts with 'role' per device.
+	 * Weights are loaded once per device and shared by its contexts.
+	 */
+	std::unique_ptr<Executor<FaceContext> > build(const Config& config,
+		const std::vector<int>& ids, int count, FaceContext::Role role, int first_cpu) {
+		const Config::Settings& settings = config.settings;
+		std::unique_ptr<Executor<FaceContext> > executor(new Executor<FaceContext>(
+			settings.execution == "actor", settings.affinity ? first_cpu : -1,
+			settings.admission.enable ? settings.admission.slo_ms * 1000 : 0));
+		const char* name = role == FaceContext::kDetection ? "detection" : "recognition";
+
+		for (int dev : ids) {
+			FaceContext* owner = nullptr;
+			for (int i = 0; i < count; ++i) {
+				std::unique_ptr<FaceContext> context(new FaceContext(config, dev, role, owner));
+				if (dev == FaceContext::kCpuDevice)
+					LOG(WARNING) << "Initialize " << name << " context " << i << " on CPU";
+				else
+					LOG(WARNING) << "Initialize " << name << " context " << i << " on GPU " << dev;
+				if (!owner)
+					owner = context.get();
+				executor->Add(std::move(context));
+			}
+		}
+		if (executor->Size() == 0)
+			throw std::invalid_argument("no face context is initialized");
+		return executor;
+	}
+
+	/* Build a complete engine from config. */
+	std::shared_ptr<Engine> build(const Config& config) {
+		const Config::Settings& settings = config.settings;
+		std::shared_ptr<Engine> engine = std::make_shared<Engine>();
+		std::vector<int> ids = devices(config);
+		int count = settings.device == "cpu" ? settings.contexts : settings.K_ctx_per_GPU;
+		int num_contexts = 0;
+		if (config.options.detection) {
+			int num = settings.pools.detection > 0 ? settings.pools.detection : count;
+			engine->detector = build(config, ids, num, FaceContext::kDetection, 0);
+			num_contexts += engine->detector->Size();
+		}
+		if (config.options.recognition) {
+			int num = settings.pools.recognition > 0 ? settings.pools.recognition : count;
+			engine->recognizer = build(config, ids, num, FaceContext::kRecognition, num_contexts);
+			engine->recognizer->Run([&engine](FaceContext* context) {
+				engine->aligner = context->center()->aligner();
+				engine->align_workers = context->center()->alignWorkers();
+			});
+		}
+		if (!engine->detector && !engine->recognizer)
+			throw std::invalid_argument("neither detection nor recognition is enabled");
+
+		const Config::Settings::Center::Batching& batching = settings.center.batching;
+		if (engine->recognizer && batching.enable) {
+			engine->batcher.reset(new Batcher<FaceContext>(*engine->recognizer,
+				engine->recognizer->Size(), batching.max_batch, batching.max_wait_us));
+			LOG(WARNING) << "Initialize extraction batcher with max batch " << batching.max_batch
+				<< " and max wait " << batching.max_wait_us << "us";
+		}
+
+		if (engine->detector && engine->recognizer && settings.pipeline.enable) {
+			engine->pipeline = buildPipeline(*engine, settings.pipeline);
+			LOG(WARNING) << "Initialize extraction pipeline with depth " << settings.pipeline.depth;
+		}
+		return engine;
+	}
 
 	bool InitEngine(const char* config_path) {
 		try {
 			Config config = Config(config_path);
-			// config logging
-			FLAGS_logtostderr = 0;
-			FLAGS_minloglevel = config.settings.glog.level;
-			FLAGS_log_dir = config.settings.glog.dir;
-			::google::InitGoogleLogging("api");
-			::google::InstallFailureSignalHandler();
-
-			int device_count;
-			cudaError_t st = cudaGetDeviceCount(&device_count);
-			if (st != cudaSuccess)
-				throw std::invalid_argument("could not list CUDA devices");
-
-			for (int dev = 0; dev < device_count; ++dev) {
-				if (!FaceContext::IsCompatible(dev)) {
-					LOG(ERROR) << "Skipping device: " << dev;
-					continue;
-				}
+			// config logging, glog could be initialized only once.
+			std::call_once(logging_flag, [&config] {
+				FLAGS_logtostderr = 0;
+				FLAGS_minloglevel = config.settings.glog.level;
+				FLAGS_log_dir = config.settings.glog.dir;
+				::google::InitGoogleLogging("api");
+				::google::InstallFailureSignalHandler();
+			});
 
-				for (int i = 0; i < config.settings.K_ctx_per_GPU; ++i){
-					std::unique_ptr<FaceContext> context(new FaceContext(config, dev));
-					LOG(WARNING) << "Initialize face context " << i << " on GPU " << dev;
-					pool.Push(std::move(context));
+			std::shared_ptr<Engine> engine = build(config);
+			if (!workers) {
+				size_t num_workers = config.settings.workers;
+				if (num_workers == 0) {
+					num_workers += engine->detector ? engine->detector->Size() : 0;
+					num_workers += engine->recognizer ? engine->recognizer->Size() : 0;
 				}
-			 }
-
-			if (pool.Size() == 0)
-				throw std::invalid_argument("no suitable CUDA device");
+				workers.reset(new ThreadPool(num_workers));
+				LOG(WARNING) << "Initialize " << num_workers << " asynchronous workers";
+			}
+			std::atomic_store(&current_engine, engine);
 			return true;
 
 		}
@@ -48,170 +159,445 @@ ContextPool<FaceContext> pool;
 		}
 	} 
 
+	bool ReloadEngine(const char* config_path) {
+		if (!std::atomic_load(&current_engine)) {
+			LOG(ERROR) << "reload before engine is initialized";
+			return false;
+		}
+		try {
+			Config config = Config(config_path);
+			std::shared_ptr<Engine> engine = build(config);
+			// requests in flight finish on the old engine, freed by the last of them.
+			std::atomic_store(&current_engine, engine);
+			LOG(WARNING) << "Reload engine from " << config_path;
+			return true;
+		}
+		catch (const std::invalid_argument& ex) {
+				LOG(ERROR) << "exception: " << ex.what();
+				return false;
+		}
+	}
+
 	cv::Mat format(const cv::Mat& image) {
 		cv::Mat sample;
-		// change image format
-		if (image.channels() == 1)
-			cv::cvtColor(image, sample, cv::COLOR_GRAY2BGR);
-		else if (image.channels() == 4)
-			cv::cvtColor(image, sample, cv::COLOR_RGBA2BGR);
+		// change image format to 3 channels of CV_8U or CV_32F, networks read both.
+		// Doubles keep their range as floats, 16-bit pixels are scaled to 8-bit.
+		if (image.depth() == CV_64F)
+			image.convertTo(sample, CV_32F);
+		else if (image.depth() == CV_16U)
+			image.convertTo(sample, CV_8U, 1.0 / 257);
+		else if (image.depth() != CV_8U && image.depth() != CV_32F)
+			image.convertTo(sample, CV_8U);
 		else
 			sample = image;
-		sample.convertTo(sample, CV_32FC3);
+
+		if (sample.channels() == 1)
+			cv::cvtColor(sample, sample, cv::COLOR_GRAY2BGR);
+		else if (sample.channels() == 4)
+			cv::cvtColor(sample, sample, cv::COLOR_RGBA2BGR);
 
 		return R(sample);
 	}
 
-	std::vector<FaceInfo> FaceDetect(const cv::Mat& image) {
-		try {
-			cv::Mat sample = format(image);
+	/* The engine in use. */
+	std::shared_ptr<Engine> current() {
+		std::shared_ptr<Engine> engine = std::atomic_load(&current_engine);
+		if (!engine)
+			throw std::invalid_argument("engine is not initialized.");
+		return engine;
+	}
 
-			{
-				/* In this scope an execution context is acquired for inference and it
-				 * will be automatically released back to the context pool when
-				 * exiting this scope. 
-				 */
-				ScopedContext<FaceContext> context(pool);
-				if (!context->enable_detect_)
-					throw std::invalid_argument("detection option is disable when call face detection.");
+	/* Run 'task' with a detection context. */
+	template <typename F>
+	auto detect(Engine& engine, F task, Deadline deadline = Deadline::max())
+		-> decltype(task(static_cast<FaceContext*>(nullptr))) {
+		if (!engine.detector)
+			throw std::invalid_argument("detection is not initialized.");
+		return engine.detector->Run(std::move(task), deadline);
+	}
 
-				return R(context->mtcnn()->detect(sample));
+	/* Run 'task' with a recognition context. */
+	template <typename F>
+	auto recognize(Engine& engine, F task, Deadline deadline = Deadline::max())
+		-> decltype(task(static_cast<FaceContext*>(nullptr))) {
+		if (!engine.recognizer)
+			throw std::invalid_argument("recognition is not initialized.");
+		return engine.recognizer->Run(std::move(task), deadline);
+	}
+
+	/* Stages of feature extraction: format, detect, align and forward.
+	 * Stages work on the engine owning the pipeline, which outlives it.
+	 */
+	std::unique_ptr<Pipeline> buildPipeline(Engine& engine, const Config::Settings::Pipeline& c_pipeline) {
+		Engine* owner = &engine;
+
+		std::vector<Pipeline::Stage> stages;
+		stages.push_back({ [](PipelineJob& job) {
+			job.sample = format(job.image);
+		}, 1 });
+		stages.push_back({ [owner](PipelineJob& job) {
+			job.infos = detect(*owner, [&](FaceContext* context) {
+				return context->mtcnn()->detect(job.sample);
+			});
+		}, static_cast<int>(engine.detector->Size()) });
+		stages.push_back({ [owner](PipelineJob& job) {
+			for (auto& info : job.infos)
+				job.faces.push_back(owner->aligner.align(job.sample, info.fpts));
+		}, c_pipeline.align_threads });
+		stages.push_back({ [owner](PipelineJob& job) {
+			if (owner->batcher) {
+				job.features = owner->batcher->Submit(R(job.faces)).get();
+				return;
 			}
+			job.features = recognize(*owner, [&](FaceContext* context) {
+				return context->center()->forward(job.faces);
+			});
+		}, static_cast<int>(engine.recognizer->Size()) });
+
+		return std::unique_ptr<Pipeline>(new Pipeline(stages, c_pipeline.depth,
+			[](std::exception_ptr error) {
+				try {
+					std::rethrow_exception(error);
+				}
+				catch (const std::exception& ex) {
+					LOG(ERROR) << "exception: " << ex.what();
+				}
+			}));
+	}
+
+	/* Wait for a batched result, but not after 'deadline'. */
+	template <typename T>
+	T wait(std::future<T> result, Deadline deadline) {
+		if (deadline != Deadline::max() &&
+			result.wait_until(deadline) == std::future_status::timeout)
+			throw DeadlineExceeded("batched extraction is not done before deadline");
+		return result.get();
+	}
+
+	/* Run api 'body', failures are turned into 'fallback' and a status. */
+	template <typename T, typename F>
+	T guard(F body, T fallback, Status* status) {
+		Status st = kFailed;
+		try {
+			T result = body();
+			if (status)
+				*status = kOk;
+			return result;
 		}
-		catch (const std::invalid_argument& ex)
-		{
+		catch (const DeadlineExceeded&) {
+			st = kTimeout;
+		}
+		catch (const Overloaded&) {
+			st = kOverloaded;
+		}
+		catch (const std::invalid_argument& ex) {
 			LOG(ERROR) << "exception: " << ex.what();
-			return R(std::vector<FaceInfo>());
 		}
+		if (status)
+			*status = st;
+		return fallback;
+	}
+
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image) {
+		return FaceDetect(image, Deadline::max(), nullptr);
+	}
+
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image, Deadline deadline, Status* status) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			cv::Mat sample = format(image);
+
+			return detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face detection.");
+
+				return context->mtcnn()->detect(sample);
+			}, deadline);
+		}, std::vector<FaceInfo>(), status);
+	}
+
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image, const DetectOptions& options) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			cv::Mat sample = format(image);
+
+			return detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face detection.");
+
+				return context->mtcnn()->detect(sample, options);
+			});
+		}, std::vector<FaceInfo>(), nullptr);
+	}
+
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image, const std::vector<cv::Rect>& rois,
+	                                 const DetectOptions& options) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			cv::Mat sample = format(image);
+
+			return detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face detection.");
+
+				return context->mtcnn()->detect(sample, rois, options);
+			});
+		}, std::vector<FaceInfo>(), nullptr);
+	}
+
+	std::vector<std::vector<FaceInfo> > FaceDetectBatch(const std::vector<cv::Mat>& images) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			std::vector<cv::Mat> samples;
+			for (auto& image : images)
+				samples.push_back(format(image));
+
+			return detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face detection.");
+
+				return context->mtcnn()->detect(samples);
+			});
+		}, std::vector<std::vector<FaceInfo> >(images.size()), nullptr);
 	}
 
 	cv::Mat FaceAlign(const cv::Mat& image, const FPoints& fpts) {
-		try {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
 			cv::Mat sample = format(image);
 
-			{
-				ScopedContext<FaceContext> context(pool);
+			return recognize(*engine, [&](FaceContext* context) {
 				if (!context->enable_recog_)
 					throw std::invalid_argument("recognition option is disable when call face alignment.");
 
-				return R(context->center()->align(sample, fpts));
-			}
-		}
-		catch (const std::invalid_argument& ex)
-		{
-			LOG(ERROR) << "exception: " << ex.what();
-			return R(cv::Mat());
-		}
+				return context->center()->align(sample, fpts);
+			});
+		}, cv::Mat(), nullptr);
 	}
 
 	std::vector<cv::Mat> FaceAlign(const cv::Mat& image, std::vector<FaceInfo> infos) {
-		try {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
 			cv::Mat sample = format(image);
 
-			{
-				ScopedContext<FaceContext> context(pool);
+			return recognize(*engine, [&](FaceContext* context) {
 				if (!context->enable_recog_)
 					throw std::invalid_argument("recognition option is disable when call face alignment.");
 
-				std::vector<cv::Mat> faces;
-				Center* center = context->center();
-				for (auto info : infos) {
-					faces.push_back(R(center->align(sample, info.fpts)));
-				}
-				return R(faces);
-			}
-		}
-		catch (const std::invalid_argument& ex)
-		{
-			LOG(ERROR) << "exception: " << ex.what();
-			return R(std::vector<cv::Mat>());
-		}
+				std::vector<FPoints> fpts;
+				for (auto& info : infos)
+					fpts.push_back(info.fpts);
+				return context->center()->alignMany(sample, fpts);
+			});
+		}, std::vector<cv::Mat>(), nullptr);
 	}
 
 	cv::Mat FaceExtract(const cv::Mat& image) {
-		try {
+		return FaceExtract(image, Deadline::max(), nullptr);
+	}
+
+	cv::Mat FaceExtract(const cv::Mat& image, Deadline deadline, Status* status) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			if (!engine->recognizer)
+				throw std::invalid_argument("recognition option is disable when call face extraction.");
 			cv::Mat sample = format(image);
 
-			{
-				ScopedContext<FaceContext> context(pool);
-				if (!context->enable_recog_)
-					throw std::invalid_argument("recognition option is disable when call face extraction.");
+			std::vector<FaceInfo> infos = detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face extraction.");
 
-				std::vector<FaceInfo> infos = context->mtcnn()->detect(sample);
-				Center* center = context->center();
-				std::vector<cv::Mat> faces;
-				for (auto info : infos) {
-					faces.push_back(R(center->align(sample, info.fpts)));
-				}
-				cv::Mat features = center->forward(faces);
-				return R(features);
+				return context->mtcnn()->detect(sample);
+			}, deadline);
+
+			std::vector<FPoints> fpts;
+			for (auto& info : infos)
+				fpts.push_back(info.fpts);
+			if (engine->batcher) {
+				// align without a context, forward together with faces of concurrent requests.
+				std::vector<cv::Mat> faces = engine->aligner.alignMany(sample, fpts, engine->align_workers.get());
+				return wait(engine->batcher->Submit(R(faces)), deadline);
 			}
-		}
-		catch (const std::invalid_argument& ex)
-		{
-			LOG(ERROR) << "exception: " << ex.what();
-			return R(cv::Mat());
-		}
+
+			// warp faces straight into the input blob
+			return recognize(*engine, [&](FaceContext* context) {
+				return context->center()->extract(sample, fpts);
+			}, deadline);
+		}, cv::Mat(), status);
 	}
 
 	cv::Mat FaceExtract(const std::vector<cv::Mat>& faces) {
-		try {
-			{
-				ScopedContext<FaceContext> context(pool);
+		return FaceExtract(faces, Deadline::max(), nullptr);
+	}
+
+	cv::Mat FaceExtract(const std::vector<cv::Mat>& faces, Deadline deadline, Status* status) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			if (engine->batcher)
+				return wait(engine->batcher->Submit(faces), deadline);
+
+			return recognize(*engine, [&](FaceContext* context) {
 				if (!context->enable_recog_)
 					throw std::invalid_argument("recognition option is disable when call face extraction.");
 
-				cv::Mat features = context->center()->forward(faces);
-				return R(features);
-			}
-		}
-		catch (const std::invalid_argument& ex)
-		{
-			LOG(ERROR) << "exception: " << ex.what();
-			return R(cv::Mat());
-		}
+				return context->center()->forward(faces);
+			}, deadline);
+		}, cv::Mat(), status);
 	}
 
 	float FaceVerify(const cv::Mat& image1, const cv::Mat& image2) {
-		try {
-			{
-				cv::Mat sample1 = format(image1);
-				cv::Mat sample2 = format(image2);
+		return FaceVerify(image1, image2, Deadline::max(), nullptr);
+	}
+
+	float FaceVerify(const cv::Mat& image1, const cv::Mat& image2,
+	                 Deadline deadline, Status* status) {
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			cv::Mat sample1 = format(image1);
+			cv::Mat sample2 = format(image2);
+
+			std::vector<FPoints> fpts = detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face verification.");
+				Mtcnn* mtcnn = context->mtcnn();
+				std::vector<FaceInfo> infos1 = mtcnn->detect(sample1, DetectOptions::Largest());
+				std::vector<FaceInfo> infos2 = mtcnn->detect(sample2, DetectOptions::Largest());
+				if (infos1.empty() || infos2.empty())
+					throw std::invalid_argument("no face is detected when call face verification.");
+				std::vector<FPoints> points;
+				points.push_back(R(infos1[0].fpts));
+				points.push_back(R(infos2[0].fpts));
+				return points;
+			}, deadline);
 
-				ScopedContext<FaceContext> context(pool);
+			return recognize(*engine, [&](FaceContext* context) {
 				if (!context->enable_recog_)
 					throw std::invalid_argument("recognition option is disable when call face verification.");
-				Mtcnn* mtcnn = context->mtcnn();
-				FPoints fpts1 = mtcnn->detect(sample1)[0].fpts;
-				FPoints fpts2 = mtcnn->detect(sample2)[0].fpts;
 
-				return context->center()->verify(sample1, fpts1, sample2, fpts2);
-			}
-		}
-		catch (const std::invalid_argument& ex)
-		{
-			LOG(ERROR) << "exception: " << ex.what();
-			return -1;
-		}
+				return context->center()->verify(sample1, fpts[0], sample2, fpts[1]);
+			}, deadline);
+		}, -1.0f, status);
 	}
 
 	float FaceVerify(const cv::Mat& image1, const FPoints& fpts1,
 									 const cv::Mat& image2, const FPoints& fpts2) {
-		try {
-			{
-				cv::Mat sample1 = format(image1);
-				cv::Mat sample2 = format(image2);
-				ScopedContext<FaceContext> context(pool);
+		return guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			cv::Mat sample1 = format(image1);
+			cv::Mat sample2 = format(image2);
+
+			return recognize(*engine, [&](FaceContext* context) {
 				if (!context->enable_recog_)
 					throw std::invalid_argument("recognition option is disable when call face verification.");
 
 				return context->center()->verify(sample1, fpts1, sample2, fpts2);
-			}
+			});
+		}, -1.0f, nullptr);
+	}
+
+	/* Run 'task' on engine workers, or in place before InitEngine. */
+	template <typename F>
+	auto async(F task) -> std::future<decltype(task())> {
+		if (!workers) {
+			LOG(ERROR) << "asynchronous call before engine is initialized";
+			std::packaged_task<decltype(task())()> inplace(std::move(task));
+			inplace();
+			return inplace.get_future();
 		}
-		catch (const std::invalid_argument& ex)
-		{
-			LOG(ERROR) << "exception: " << ex.what();
-			return -1;}
+		return workers->Submit(std::move(task));
+	}
+
+	/* Call completion callback 'done', nobody waits for it to rethrow. */
+	template <typename T>
+	void notify(const std::function<void(T)>& done, T result) {
+		try {
+			done(R(result));
+		}
+		catch (const std::exception& ex) {
+			LOG(ERROR) << "exception in callback: " << ex.what();
+		}
+		catch (...) {
+			LOG(ERROR) << "unknown exception in callback";
+		}
+	}
+
+	std::future<std::vector<FaceInfo> > FaceDetectAsync(const cv::Mat& image) {
+		return async([image] { return FaceDetect(image); });
+	}
+
+	std::future<cv::Mat> FaceExtractAsync(const cv::Mat& image) {
+		std::shared_ptr<Engine> engine = std::atomic_load(&current_engine);
+		if (engine && engine->pipeline)
+			return engine->pipeline->Submit(image);
+		return async([image] { return FaceExtract(image); });
+	}
+
+	std::future<cv::Mat> FaceExtractAsync(const std::vector<cv::Mat>& faces) {
+		return async([faces] { return FaceExtract(faces); });
+	}
+
+	std::future<float> FaceVerifyAsync(const cv::Mat& image1, const cv::Mat& image2) {
+		return async([image1, image2] { return FaceVerify(image1, image2); });
+	}
+
+	void FaceDetectAsync(const cv::Mat& image,
+	                     std::function<void(std::vector<FaceInfo>)> done) {
+		async([image, done] { notify(done, FaceDetect(image)); });
+	}
+
+	void FaceExtractAsync(const cv::Mat& image,
+	                      std::function<void(cv::Mat)> done) {
+		async([image, done] { notify(done, FaceExtract(image)); });
+	}
+
+	std::vector<cv::Mat> FaceExtractImages(const std::vector<cv::Mat>& images) {
+		std::vector<std::future<cv::Mat> > results;
+		for (auto& image : images)
+			results.push_back(FaceExtractAsync(image));
+
+		std::vector<cv::Mat> features;
+		for (auto& result : results)
+			features.push_back(result.get());
+		return R(features);
+	}
+
+	void FaceVerifyAsync(const cv::Mat& image1, const cv::Mat& image2,
+	                     std::function<void(float)> done) {
+		async([image1, image2, done] { notify(done, FaceVerify(image1, image2)); });
+	}
+
+	FaceStream::FaceStream(int rescan_interval, float margin)
+		: rescan_interval_(std::max(rescan_interval, 1)),
+		margin_(margin),
+		frame_(0),
+		lost_(false) {}
+
+	std::vector<FaceInfo> FaceStream::Detect(const cv::Mat& frame) {
+		bool rescan = faces_.empty() || lost_ || frame_ % rescan_interval_ == 0;
+		frame_++;
+
+		std::vector<FaceInfo> faces = guard([&] {
+			std::shared_ptr<Engine> engine = current();
+			cv::Mat sample = format(frame);
+
+			return detect(*engine, [&](FaceContext* context) {
+				if (!context->enable_detect_)
+					throw std::invalid_argument("detection option is disable when call face detection.");
+
+				Mtcnn* mtcnn = context->mtcnn();
+				return rescan ? mtcnn->detect(sample) : mtcnn->track(sample, faces_, margin_);
+			});
+		}, std::vector<FaceInfo>(), nullptr);
+
+		lost_ = !rescan && faces.size() < faces_.size();
+		faces_ = faces;
+		return R(faces);
+	}
+
+	void FaceStream::Reset() {
+		frame_ = 0;
+		lost_ = false;
+		faces_.clear();
 	}
 
 } // ocean_ai
\ No newline at end of file
@@ -5,15 +5,41 @@
 // Titan sm52/sm50
 // 10x0 sm61
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include "common.hpp"
 
 namespace ocean_ai {
 
+	// Deadline of a request on the steady clock.
+	typedef std::chrono::steady_clock::time_point Deadline;
+
+	// Status of a request.
+	enum Status {
+		kOk = 0,
+		kFailed,		// invalid input or engine
+		kTimeout,		// deadline is exceeded
+		kOverloaded		// rejected by admission control
+	};
+
 	// Init caffe context
 	bool InitEngine(const char* config_path);
 
+	// Build a new engine from config in the caller thread and swap it in,
+	// requests in flight finish on the old one. Workers are not resized.
+	bool ReloadEngine(const char* config_path);
+
 	// Face detection
 	std::vector<FaceInfo> FaceDetect(const cv::Mat& image);
+	// Face detection stopping early once enough faces are found.
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image, const DetectOptions& options);
+	// Face detection only inside regions of interest, eg. from a person detector.
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image, const std::vector<cv::Rect>& rois,
+	                                 const DetectOptions& options = DetectOptions());
+	// Face detection of several images, R/O/L-Net batches are shared by all
+	// images. Results are per image, in the order of 'images'.
+	std::vector<std::vector<FaceInfo> > FaceDetectBatch(const std::vector<cv::Mat>& images);
 
 	// Face alignments
 	cv::Mat FaceAlign(const cv::Mat& image, const FPoints& fpts);
@@ -28,6 +54,55 @@ namespace ocean_ai {
 	float FaceVerify(const cv::Mat& image1, const FPoints& fpts1,
 	                 const cv::Mat& image2, const FPoints& fpts2);
 
+	// Deadline aware api: never wait for a context past 'deadline',
+	// failures return empty results and set 'status' if given.
+	std::vector<FaceInfo> FaceDetect(const cv::Mat& image,
+	                                 Deadline deadline, Status* status);
+	cv::Mat FaceExtract(const cv::Mat& image,
+	                    Deadline deadline, Status* status);
+	cv::Mat FaceExtract(const std::vector<cv::Mat>& faces,
+	                    Deadline deadline, Status* status);
+	float FaceVerify(const cv::Mat& image1, const cv::Mat& image2,
+	                 Deadline deadline, Status* status);
+
+	// Asynchronous api running on engine workers.
+	// Image data is shared, not copied: keep it unchanged until done.
+	std::future<std::vector<FaceInfo> > FaceDetectAsync(const cv::Mat& image);
+	std::future<cv::Mat> FaceExtractAsync(const cv::Mat& image);
+	std::future<cv::Mat> FaceExtractAsync(const std::vector<cv::Mat>& faces);
+	std::future<float> FaceVerifyAsync(const cv::Mat& image1, const cv::Mat& image2);
+
+	// Asynchronous api with completion callback called on an engine worker.
+	// Callbacks must not throw, exceptions escaping them are only logged.
+	void FaceDetectAsync(const cv::Mat& image,
+	                     std::function<void(std::vector<FaceInfo>)> done);
+	void FaceExtractAsync(const cv::Mat& image,
+	                      std::function<void(cv::Mat)> done);
+	void FaceVerifyAsync(const cv::Mat& image1, const cv::Mat& image2,
+	                     std::function<void(float)> done);
+
+	// Extract features of faces in every image, pipelined if enabled.
+	std::vector<cv::Mat> FaceExtractImages(const std::vector<cv::Mat>& images);
+
+	// Face detection of a video stream, one object per stream, not thread-safe.
+	// Faces of the last frame are tracked by R-Net/O-Net on boxes enlarged by
+	// 'margin', the full pyramid is scanned every 'rescan_interval' frames,
+	// when there is nothing to track, or after a track is lost.
+	class FaceStream {
+	public:
+		explicit FaceStream(int rescan_interval = 10, float margin = 0.2f);
+		std::vector<FaceInfo> Detect(const cv::Mat& frame);
+		// Forget tracks, eg. on a scene cut.
+		void Reset();
+
+	private:
+		int rescan_interval_;
+		float margin_;
+		int frame_;
+		bool lost_;
+		std::vector<FaceInfo> faces_;
+	};
+
 } // ocean_ai
 
 
@@ -0,0 +1,67 @@
+#ifndef OCEAN_AI_NET_UTILS_HPP_
+#define OCEAN_AI_NET_UTILS_HPP_
+
+#include <caffe/caffe.hpp>
+
+namespace ocean_ai {
+
+	/* Push trained weights to the memory of current caffe mode, so nets sharing
+	 * them never race on the lazy host/device synchronization of first forward.
+	 */
+	inline void syncParams(const caffe::Net<float>& net) {
+		for (auto& param : net.params()) {
+			if (caffe::Caffe::mode() == caffe::Caffe::GPU)
+				param->gpu_data();
+			else
+				param->cpu_data();
+		}
+	}
+
+	/* Create a net from deploy prototxt which shares trained weights of 'owner'
+	 * read-only, only activation blobs are allocated for the new net.
+	 */
+	inline std::shared_ptr<caffe::Net<float> > shareNet(const std::string& deploy,
+		const caffe::Net<float>& owner) {
+		auto net = std::make_shared<caffe::Net<float>>(deploy, caffe::TEST);
+		net->ShareTrainedLayersWith(&owner);
+		return net;
+	}
+
+	/* Batch sizes nets are reshaped to, so only a few input shapes occur.
+	 * 2 fits the pair of faces of a verification exactly.
+	 */
+	const int kBatchBuckets[] = {1, 2, 8, 32, 128};
+
+	/* Smallest bucket holding 'num' inputs, at most 'max_batch'. */
+	inline int batchBucket(int num, int max_batch) {
+		for (int bucket : kBatchBuckets) {
+			if (bucket >= max_batch)
+				break;
+			if (bucket >= num)
+				return bucket;
+		}
+		return max_batch;
+	}
+
+	/* Reshape the input batch of 'net', skipped when it is unchanged.
+	 * Blobs only grow, so after reserveBatch() no reshape reallocates.
+	 */
+	inline void reshapeBatch(caffe::Net<float>& net, int batch_size) {
+		caffe::Blob<float>* input_layer = net.input_blobs()[0];
+		if (input_layer->shape(0) == batch_size)
+			return;
+		std::vector<int> input_shape = input_layer->shape();
+		input_shape[0] = batch_size;
+		input_layer->Reshape(input_shape);
+		net.Reshape();
+	}
+
+	/* Allocate blobs of 'net' for the largest batch up front. */
+	inline void reserveBatch(caffe::Net<float>& net, int max_batch) {
+		reshapeBatch(net, max_batch);
+		reshapeBatch(net, 1);
+	}
+
+} // ocean_ai
+
+#endif // OCEAN_AI_NET_UTILS_HPP_
@@ -0,0 +1,262 @@
+#include "nms.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCEAN_AI_X86
+#include <immintrin.h>
+#endif
+
+namespace ocean_ai {
+
+	namespace {
+
+		// widest SIMD lanes of the kernels, AVX.
+		const int kLanes = 8;
+
+		/* Boxes in descending order of score, padded with empty boxes to
+		 * whole SIMD lanes. Empty boxes never overlap anything.
+		 */
+		struct SortedBoxes {
+			std::vector<int> order;
+			std::vector<float> x1, y1, x2, y2, area;
+
+			explicit SortedBoxes(const BoxBuffer& boxes) : order(boxes.size()) {
+				std::iota(order.begin(), order.end(), 0);
+				// ties keep input order, so results are deterministic.
+				std::stable_sort(order.begin(), order.end(), [&boxes](int a, int b) {
+					return boxes.scores[a] > boxes.scores[b]; });
+
+				size_t padded = (order.size() + kLanes - 1) / kLanes * kLanes;
+				x1.assign(padded, 0.0f);
+				y1.assign(padded, 0.0f);
+				x2.assign(padded, 0.0f);
+				y2.assign(padded, 0.0f);
+				area.assign(padded, 0.0f);
+				for (size_t i = 0; i < order.size(); ++i) {
+					int k = order[i];
+					x1[i] = boxes.x1[k];
+					y1[i] = boxes.y1[k];
+					x2[i] = boxes.x2[k];
+					y2[i] = boxes.y2[k];
+					area[i] = (x2[i] - x1[i]) * (y2[i] - y1[i]);
+				}
+			}
+		};
+
+		/* Whether sorted box 'j' overlaps sorted box 'i' above 'threshold',
+		 * with the same arithmetic as the SIMD lanes.
+		 */
+		template <Overlap type>
+		inline bool overlaps(const SortedBoxes& b, size_t i, size_t j, float threshold) {
+			float w = std::min(b.x2[i], b.x2[j]) - std::max(b.x1[i], b.x1[j]);
+			float h = std::min(b.y2[i], b.y2[j]) - std::max(b.y1[i], b.y1[j]);
+			if (!(w > 0.0f && h > 0.0f))
+				return false;
+			float inter = w * h;
+			float outer = type == kIoM ? std::min(b.area[i], b.area[j])
+				: b.area[i] + b.area[j] - inter;
+			return inter > threshold * outer;
+		}
+
+		/* Mark sorted boxes [begin, size) overlapping box 'i' in 'suppressed',
+		 * 'begin' is a multiple of kLanes.
+		 */
+		typedef void (*SuppressFunc)(const SortedBoxes& b, size_t i, size_t begin, float threshold,
+			std::vector<uint64_t>& suppressed);
+
+		template <Overlap type>
+		void suppressScalar(const SortedBoxes& b, size_t i, size_t begin, float threshold,
+			std::vector<uint64_t>& suppressed) {
+			for (size_t j = begin; j < b.x1.size(); ++j)
+				if (overlaps<type>(b, i, j, threshold))
+					suppressed[j >> 6] |= uint64_t(1) << (j & 63);
+		}
+
+#ifdef OCEAN_AI_X86
+		template <Overlap type>
+		__attribute__((target("avx")))
+		void suppressAvx(const SortedBoxes& b, size_t i, size_t begin, float threshold,
+			std::vector<uint64_t>& suppressed) {
+			size_t size = b.x1.size();
+			const __m256 x1 = _mm256_set1_ps(b.x1[i]);
+			const __m256 y1 = _mm256_set1_ps(b.y1[i]);
+			const __m256 x2 = _mm256_set1_ps(b.x2[i]);
+			const __m256 y2 = _mm256_set1_ps(b.y2[i]);
+			const __m256 area = _mm256_set1_ps(b.area[i]);
+			const __m256 thresh = _mm256_set1_ps(threshold);
+			const __m256 zero = _mm256_setzero_ps();
+			for (size_t j = begin; j < size; j += 8) {
+				__m256 w = _mm256_sub_ps(_mm256_min_ps(x2, _mm256_loadu_ps(&b.x2[j])),
+					_mm256_max_ps(x1, _mm256_loadu_ps(&b.x1[j])));
+				__m256 h = _mm256_sub_ps(_mm256_min_ps(y2, _mm256_loadu_ps(&b.y2[j])),
+					_mm256_max_ps(y1, _mm256_loadu_ps(&b.y1[j])));
+				__m256 inter = _mm256_mul_ps(w, h);
+				__m256 areas = _mm256_loadu_ps(&b.area[j]);
+				__m256 outer = type == kIoM ? _mm256_min_ps(area, areas)
+					: _mm256_sub_ps(_mm256_add_ps(area, areas), inter);
+				__m256 hit = _mm256_and_ps(
+					_mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GT_OQ), _mm256_cmp_ps(h, zero, _CMP_GT_OQ)),
+					_mm256_cmp_ps(inter, _mm256_mul_ps(thresh, outer), _CMP_GT_OQ));
+				uint64_t mask = static_cast<uint64_t>(_mm256_movemask_ps(hit));
+				if (mask)
+					suppressed[j >> 6] |= mask << (j & 63);
+			}
+		}
+
+		template <Overlap type>
+		__attribute__((target("sse2")))
+		void suppressSse2(const SortedBoxes& b, size_t i, size_t begin, float threshold,
+			std::vector<uint64_t>& suppressed) {
+			size_t size = b.x1.size();
+			const __m128 x1 = _mm_set1_ps(b.x1[i]);
+			const __m128 y1 = _mm_set1_ps(b.y1[i]);
+			const __m128 x2 = _mm_set1_ps(b.x2[i]);
+			const __m128 y2 = _mm_set1_ps(b.y2[i]);
+			const __m128 area = _mm_set1_ps(b.area[i]);
+			const __m128 thresh = _mm_set1_ps(threshold);
+			const __m128 zero = _mm_setzero_ps();
+			for (size_t j = begin; j < size; j += 4) {
+				__m128 w = _mm_sub_ps(_mm_min_ps(x2, _mm_loadu_ps(&b.x2[j])),
+					_mm_max_ps(x1, _mm_loadu_ps(&b.x1[j])));
+				__m128 h = _mm_sub_ps(_mm_min_ps(y2, _mm_loadu_ps(&b.y2[j])),
+					_mm_max_ps(y1, _mm_loadu_ps(&b.y1[j])));
+				__m128 inter = _mm_mul_ps(w, h);
+				__m128 areas = _mm_loadu_ps(&b.area[j]);
+				__m128 outer = type == kIoM ? _mm_min_ps(area, areas)
+					: _mm_sub_ps(_mm_add_ps(area, areas), inter);
+				__m128 hit = _mm_and_ps(
+					_mm_and_ps(_mm_cmpgt_ps(w, zero), _mm_cmpgt_ps(h, zero)),
+					_mm_cmpgt_ps(inter, _mm_mul_ps(thresh, outer)));
+				uint64_t mask = static_cast<uint64_t>(_mm_movemask_ps(hit));
+				if (mask)
+					suppressed[j >> 6] |= mask << (j & 63);
+			}
+		}
+#endif
+
+		template <Overlap type>
+		SuppressFunc selectSuppress() {
+#ifdef OCEAN_AI_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx"))
+				return suppressAvx<type>;
+			if (__builtin_cpu_supports("sse2"))
+				return suppressSse2<type>;
+#endif
+			return suppressScalar<type>;
+		}
+
+		/* Kernel of an overlap type, picked once by the features of the running CPU. */
+		template <Overlap type>
+		struct Suppress {
+			static const SuppressFunc func;
+		};
+		template <Overlap type>
+		const SuppressFunc Suppress<type>::func = selectSuppress<type>();
+
+		inline bool isSet(const std::vector<uint64_t>& bits, size_t i) {
+			return (bits[i >> 6] >> (i & 63)) & 1;
+		}
+
+	} // namespace
+
+	template <Overlap type>
+	std::vector<int> NonMaximumSuppression(const BoxBuffer& boxes, const float threshold)
+	{
+		SortedBoxes sorted(boxes);
+		size_t num = sorted.order.size();
+		std::vector<uint64_t> suppressed((sorted.x1.size() + 63) / 64, 0);
+
+		std::vector<int> keep;
+		for (size_t i = 0; i < num; ++i) {
+			if (isSet(suppressed, i))
+				continue;
+			keep.push_back(sorted.order[i]);
+			// lanes before i+1 are already decided, marking them is harmless.
+			size_t begin = (i + 1) / kLanes * kLanes;
+			Suppress<type>::func(sorted, i, begin, threshold, suppressed);
+		}
+
+		return R(keep);
+	}
+
+	template <Overlap type>
+	std::vector<int> GridNonMaximumSuppression(const BoxBuffer& boxes, const float threshold)
+	{
+		SortedBoxes sorted(boxes);
+		size_t num = sorted.order.size();
+		if (num == 0)
+			return std::vector<int>();
+
+		// overlapping boxes have centers less than the largest box apart.
+		float min_x = sorted.x1[0], min_y = sorted.y1[0];
+		float max_x = sorted.x2[0], max_y = sorted.y2[0];
+		float cell = 1.0f;
+		for (size_t i = 0; i < num; ++i) {
+			min_x = std::min(min_x, sorted.x1[i]);
+			min_y = std::min(min_y, sorted.y1[i]);
+			max_x = std::max(max_x, sorted.x2[i]);
+			max_y = std::max(max_y, sorted.y2[i]);
+			cell = std::max(cell, std::max(sorted.x2[i] - sorted.x1[i], sorted.y2[i] - sorted.y1[i]));
+		}
+		// tiny boxes far apart would make a huge grid, keep cells about as many as boxes.
+		// Counted in doubles, a single row or column still has at least one cell across.
+		double cols_f, rows_f;
+		for (;; cell *= 2.0f) {
+			cols_f = std::floor((max_x - min_x) / cell) + 1.0;
+			rows_f = std::floor((max_y - min_y) / cell) + 1.0;
+			if (cols_f * rows_f <= 4.0 * num + 1024.0)
+				break;
+		}
+		int cols = static_cast<int>(cols_f);
+		int rows = static_cast<int>(rows_f);
+
+		// bucket boxes by the cell of their center, in score order.
+		std::vector<int> cells(num);
+		std::vector<int> starts(cols * rows + 1, 0);
+		for (size_t i = 0; i < num; ++i) {
+			int col = static_cast<int>(((sorted.x1[i] + sorted.x2[i]) * 0.5f - min_x) / cell);
+			int row = static_cast<int>(((sorted.y1[i] + sorted.y2[i]) * 0.5f - min_y) / cell);
+			cells[i] = std::min(row, rows - 1) * cols + std::min(col, cols - 1);
+			starts[cells[i] + 1]++;
+		}
+		std::partial_sum(starts.begin(), starts.end(), starts.begin());
+		std::vector<int> buckets(num);
+		std::vector<int> fill(starts.begin(), starts.end() - 1);
+		for (size_t i = 0; i < num; ++i)
+			buckets[fill[cells[i]]++] = static_cast<int>(i);
+
+		std::vector<uint64_t> suppressed((num + 63) / 64, 0);
+		std::vector<int> keep;
+		for (size_t i = 0; i < num; ++i) {
+			if (isSet(suppressed, i))
+				continue;
+			keep.push_back(sorted.order[i]);
+
+			int row = cells[i] / cols;
+			int col = cells[i] % cols;
+			for (int r = std::max(row - 1, 0); r <= std::min(row + 1, rows - 1); ++r)
+				for (int c = std::max(col - 1, 0); c <= std::min(col + 1, cols - 1); ++c) {
+					int id = r * cols + c;
+					// buckets are in score order, skip the decided boxes.
+					const int* begin = &buckets[0] + starts[id];
+					const int* end = &buckets[0] + starts[id + 1];
+					for (const int* j = std::upper_bound(begin, end, static_cast<int>(i)); j != end; ++j)
+						if (!isSet(suppressed, *j) && overlaps<type>(sorted, i, *j, threshold))
+							suppressed[*j >> 6] |= uint64_t(1) << (*j & 63);
+				}
+		}
+
+		return R(keep);
+	}
+
+	template std::vector<int> NonMaximumSuppression<kIoU>(const BoxBuffer&, const float);
+	template std::vector<int> NonMaximumSuppression<kIoM>(const BoxBuffer&, const float);
+	template std::vector<int> GridNonMaximumSuppression<kIoU>(const BoxBuffer&, const float);
+	template std::vector<int> GridNonMaximumSuppression<kIoM>(const BoxBuffer&, const float);
+
+} // ocean_ai
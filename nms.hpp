@@ -0,0 +1,68 @@
+#ifndef OCEAN_AI_NMS_HPP_
+#define OCEAN_AI_NMS_HPP_
+
+#include <vector>
+
+#include "common.hpp"
+
+namespace ocean_ai {
+
+	enum Overlap {
+		kIoU,	// Intersection over Union
+		kIoM	// Intersection over Minimum
+	};
+
+	/* Boxes and scores as a struct of arrays, for SIMD loads in NMS. */
+	class BoxBuffer {
+	public:
+		std::vector<float> x1, y1, x2, y2;
+		std::vector<float> scores;
+
+		void reserve(size_t n) {
+			x1.reserve(n);
+			y1.reserve(n);
+			x2.reserve(n);
+			y2.reserve(n);
+			scores.reserve(n);
+		}
+
+		void push_back(const BBox& bbox, float score) {
+			x1.push_back(bbox[0]);
+			y1.push_back(bbox[1]);
+			x2.push_back(bbox[2]);
+			y2.push_back(bbox[3]);
+			scores.push_back(score);
+		}
+
+		void clear() {
+			x1.clear();
+			y1.clear();
+			x2.clear();
+			y2.clear();
+			scores.clear();
+		}
+
+		size_t size() const {
+			return scores.size();
+		}
+	};
+
+	/* Greedy Non Maximum Suppression, returns indices of kept boxes in
+	 * descending order of score. Boxes are visited in score order and each
+	 * kept box marks all later boxes overlapping it above 'threshold' in a
+	 * bitmask, four or eight at a time with SSE or AVX.
+	 */
+	template <Overlap type>
+	std::vector<int> NonMaximumSuppression(const BoxBuffer& boxes, const float threshold);
+
+	/* Same result as NonMaximumSuppression, but a kept box only checks boxes
+	 * bucketed in the 3x3 cells around its center. Cells are as large as the
+	 * largest box, so it pays off for many boxes of similar size, like the
+	 * candidates of one P-Net scale.
+	 */
+	template <Overlap type>
+	std::vector<int> GridNonMaximumSuppression(const BoxBuffer& boxes, const float threshold);
+
+} // ocean_ai
+
+#endif // OCEAN_AI_NMS_HPP_
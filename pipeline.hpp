@@ -0,0 +1,158 @@
+#ifndef OCEAN_AI_PIPELINE_HPP_
+#define OCEAN_AI_PIPELINE_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+
+namespace ocean_ai {
+
+	/* A blocking queue holding at most 'capacity' values, closing it lets
+	 * consumers drain the rest and then stop.
+	 */
+	template <typename T>
+	class BoundedQueue
+	{
+	public:
+		explicit BoundedQueue(size_t capacity)
+			: capacity_(capacity), closed_(false) {}
+
+		void Push(T value)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+			queue_.push_back(std::move(value));
+			lock.unlock();
+			not_empty_.notify_one();
+		}
+
+		bool Pop(T& value)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			not_empty_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+			if (queue_.empty())
+				return false;
+			value = std::move(queue_.front());
+			queue_.pop_front();
+			lock.unlock();
+			not_full_.notify_one();
+			return true;
+		}
+
+		void Close()
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			closed_ = true;
+			lock.unlock();
+			not_empty_.notify_all();
+		}
+
+	private:
+		const size_t capacity_;
+		bool closed_;
+		std::mutex mutex_;
+		std::condition_variable not_empty_;
+		std::condition_variable not_full_;
+		std::deque<T> queue_;
+	};
+
+	/* An image flowing through the stages of feature extraction. */
+	struct PipelineJob
+	{
+		cv::Mat image;			// input image
+		cv::Mat sample;			// formatted image
+		std::vector<FaceInfo> infos;	// detected faces
+		std::vector<cv::Mat> faces;	// aligned faces
+		cv::Mat features;		// extracted features
+		std::promise<cv::Mat> done;
+	};
+
+	/* Stages run on their own threads and hand jobs over through bounded
+	 * queues, so image N+1 is detected while faces of image N are embedded.
+	 * A job failing in any stage is reported to 'on_error' and resolves to
+	 * empty features.
+	 */
+	class Pipeline
+	{
+	public:
+		struct Stage
+		{
+			std::function<void(PipelineJob&)> work;
+			int threads;
+		};
+
+		typedef std::function<void(std::exception_ptr)> ErrorHandler;
+
+		Pipeline(const std::vector<Stage>& stages, size_t depth, ErrorHandler on_error)
+			: stages_(stages),
+			on_error_(on_error),
+			alive_(new std::atomic<int>[stages.size()])
+		{
+			for (size_t i = 0; i < stages_.size(); ++i) {
+				queues_.emplace_back(new BoundedQueue<std::unique_ptr<PipelineJob> >(depth));
+				alive_[i].store(stages_[i].threads);
+			}
+			for (size_t i = 0; i < stages_.size(); ++i)
+				for (int t = 0; t < stages_[i].threads; ++t)
+					threads_.emplace_back(&Pipeline::Run, this, i);
+		}
+
+		/* Finish queued jobs, then stop stage by stage. */
+		~Pipeline()
+		{
+			if (!queues_.empty())
+				queues_[0]->Close();
+			for (auto& thread : threads_)
+				thread.join();
+		}
+
+		std::future<cv::Mat> Submit(cv::Mat image)
+		{
+			std::unique_ptr<PipelineJob> job(new PipelineJob);
+			job->image = std::move(image);
+			std::future<cv::Mat> features = job->done.get_future();
+			queues_[0]->Push(std::move(job));
+			return features;
+		}
+
+	private:
+		void Run(size_t stage)
+		{
+			bool last = stage + 1 == stages_.size();
+			std::unique_ptr<PipelineJob> job;
+			while (queues_[stage]->Pop(job)) {
+				try {
+					stages_[stage].work(*job);
+				}
+				catch (...) {
+					on_error_(std::current_exception());
+					job->done.set_value(cv::Mat());
+					continue;
+				}
+				if (last)
+					job->done.set_value(std::move(job->features));
+				else
+					queues_[stage + 1]->Push(std::move(job));
+			}
+			// the last thread of a stage closes the next one.
+			if (alive_[stage].fetch_sub(1) == 1 && !last)
+				queues_[stage + 1]->Close();
+		}
+
+		std::vector<Stage> stages_;
+		ErrorHandler on_error_;
+		std::vector<std::unique_ptr<BoundedQueue<std::unique_ptr<PipelineJob> > > > queues_;
+		std::unique_ptr<std::atomic<int>[]> alive_;
+		std::vector<std::thread> threads_;
+	};
+
+} // ocean_ai
+
+#endif // OCEAN_AI_PIPELINE_HPP_
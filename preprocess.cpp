@@ -0,0 +1,279 @@
+#include "preprocess.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCEAN_AI_X86
+#include <immintrin.h>
+#endif
+
+namespace ocean_ai {
+
+	namespace {
+
+		/* Source taps of one destination coordinate: pixels 'i0' and 'i1' of the
+		 * image, -1 when outside it, and weight 'w' of 'i1'.
+		 */
+		struct Taps {
+			std::vector<int> i0, i1;
+			std::vector<float> w;
+		};
+
+		/* Half-pixel mapping of cv::resize, clamped to the region. */
+		void mapTaps(int origin, int src_len, int dst_len, int image_len, Taps& taps) {
+			taps.i0.resize(dst_len);
+			taps.i1.resize(dst_len);
+			taps.w.resize(dst_len);
+			float scale = static_cast<float>(src_len) / dst_len;
+			for (int d = 0; d < dst_len; ++d) {
+				float f = (d + 0.5f) * scale - 0.5f;
+				int s = static_cast<int>(std::floor(f));
+				float w = f - s;
+				if (s < 0) {
+					s = 0;
+					w = 0.0f;
+				}
+				if (s >= src_len - 1) {
+					s = src_len - 1;
+					w = 0.0f;
+				}
+				int s0 = origin + s;
+				int s1 = origin + std::min(s + 1, src_len - 1);
+				taps.i0[d] = s0 >= 0 && s0 < image_len ? s0 : -1;
+				taps.i1[d] = s1 >= 0 && s1 < image_len ? s1 : -1;
+				taps.w[d] = w;
+			}
+		}
+
+		/* Horizontal pass of one image row into three planar rows. */
+		template <typename T>
+		void horizontal(const cv::Mat& image, int y, const Taps& xs, float* row, int width) {
+			float* b = row;
+			float* g = row + width;
+			float* r = row + 2 * width;
+			if (y < 0) {	// outside the image
+				std::fill(row, row + 3 * width, 0.0f);
+				return;
+			}
+			const T* src = image.ptr<T>(y);
+			for (int d = 0; d < width; ++d) {
+				int i0 = xs.i0[d], i1 = xs.i1[d];
+				float w = xs.w[d];
+				float b0 = 0.0f, g0 = 0.0f, r0 = 0.0f;
+				float b1 = 0.0f, g1 = 0.0f, r1 = 0.0f;
+				if (i0 >= 0) {
+					b0 = src[3 * i0];
+					g0 = src[3 * i0 + 1];
+					r0 = src[3 * i0 + 2];
+				}
+				if (i1 >= 0) {
+					b1 = src[3 * i1];
+					g1 = src[3 * i1 + 1];
+					r1 = src[3 * i1 + 2];
+				}
+				b[d] = b0 + (b1 - b0) * w;
+				g[d] = g0 + (g1 - g0) * w;
+				r[d] = r0 + (r1 - r0) * w;
+			}
+		}
+
+		/* Vertical pass and normalization: out = (a + (b - a) * w) * alpha + beta */
+		typedef void (*BlendFunc)(const float* a, const float* b, float w,
+			float alpha, float beta, float* out, int n);
+
+		void blendScalar(const float* a, const float* b, float w,
+			float alpha, float beta, float* out, int n) {
+			for (int i = 0; i < n; ++i)
+				out[i] = (a[i] + (b[i] - a[i]) * w) * alpha + beta;
+		}
+
+#ifdef OCEAN_AI_X86
+		__attribute__((target("sse2")))
+		void blendSse2(const float* a, const float* b, float w,
+			float alpha, float beta, float* out, int n) {
+			const __m128 vw = _mm_set1_ps(w);
+			const __m128 va = _mm_set1_ps(alpha);
+			const __m128 vb = _mm_set1_ps(beta);
+			int i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 x = _mm_loadu_ps(a + i);
+				__m128 y = _mm_loadu_ps(b + i);
+				x = _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(y, x), vw));
+				_mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(x, va), vb));
+			}
+			blendScalar(a + i, b + i, w, alpha, beta, out + i, n - i);
+		}
+
+		__attribute__((target("avx2,fma")))
+		void blendAvx2(const float* a, const float* b, float w,
+			float alpha, float beta, float* out, int n) {
+			const __m256 vw = _mm256_set1_ps(w);
+			const __m256 va = _mm256_set1_ps(alpha);
+			const __m256 vb = _mm256_set1_ps(beta);
+			int i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 x = _mm256_loadu_ps(a + i);
+				__m256 y = _mm256_loadu_ps(b + i);
+				x = _mm256_fmadd_ps(_mm256_sub_ps(y, x), vw, x);
+				_mm256_storeu_ps(out + i, _mm256_fmadd_ps(x, va, vb));
+			}
+			blendScalar(a + i, b + i, w, alpha, beta, out + i, n - i);
+		}
+#endif
+
+		BlendFunc selectBlend() {
+#ifdef OCEAN_AI_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+				return blendAvx2;
+			if (__builtin_cpu_supports("sse2"))
+				return blendSse2;
+#endif
+			return blendScalar;
+		}
+
+		const BlendFunc blend = selectBlend();
+
+		/* Buffers of resizeToPlanar, kept by each thread and only grown, so
+		 * crops of a warm thread allocate nothing.
+		 */
+		struct Scratch {
+			Taps xs, ys;
+			std::vector<float> rows;
+		};
+
+		template <typename T>
+		void resizeToPlanar(const cv::Mat& image, const cv::Rect& region, const cv::Size& size,
+			Planar dst, float alpha, float beta, const Planar* mirrored) {
+			static thread_local Scratch scratch;
+			const Taps& xs = scratch.xs;
+			const Taps& ys = scratch.ys;
+			mapTaps(region.x, region.width, size.width, image.cols, scratch.xs);
+			mapTaps(region.y, region.height, size.height, image.rows, scratch.ys);
+
+			// horizontally resized source rows 'y0' and 'y1', three planes each.
+			int width = size.width;
+			scratch.rows.resize(6 * width);
+			float* row0 = &scratch.rows[0];
+			float* row1 = &scratch.rows[3 * width];
+			int y0 = -2, y1 = -2;	// -1 is a row outside the image
+			for (int d = 0; d < size.height; ++d) {
+				int need0 = ys.i0[d], need1 = ys.i1[d];
+				if (need0 == y1 && need0 != y0) {	// moved down by one row
+					std::swap(row0, row1);
+					std::swap(y0, y1);
+				}
+				if (need0 != y0) {
+					horizontal<T>(image, need0, xs, row0, width);
+					y0 = need0;
+				}
+				if (need1 != y1) {
+					horizontal<T>(image, need1, xs, row1, width);
+					y1 = need1;
+				}
+				for (int c = 0; c < 3; ++c) {
+					float* out = dst.data + c * dst.plane_step + d * dst.row_step;
+					blend(row0 + c * width, row1 + c * width, ys.w[d], alpha, beta, out, width);
+					if (mirrored)
+						std::reverse_copy(out, out + width,
+							mirrored->data + c * mirrored->plane_step + d * mirrored->row_step);
+				}
+			}
+		}
+
+		/* Pixel 'x', 'y' of channel 'c', 0 outside the image. */
+		template <typename T>
+		inline float pixel(const cv::Mat& image, int x, int y, int c) {
+			if (x < 0 || y < 0 || x >= image.cols || y >= image.rows)
+				return 0.0f;
+			return image.ptr<T>(y)[3 * x + c];
+		}
+
+		template <typename T>
+		void warpToPlanar(const cv::Mat& image, const cv::Mat& tform, const cv::Size& size,
+			Planar dst, float alpha, float beta, const Planar* mirrored) {
+			// destination to source map, the inverse of 'tform'.
+			double a = tform.at<double>(0, 0), b = tform.at<double>(0, 1);
+			double c = tform.at<double>(1, 0), d = tform.at<double>(1, 1);
+			double det = a * d - b * c;
+			if (det == 0.0)
+				throw std::invalid_argument("singular transform to warp.");
+			double m[6];
+			m[0] = d / det;
+			m[1] = -b / det;
+			m[3] = -c / det;
+			m[4] = a / det;
+			m[2] = -(m[0] * tform.at<double>(0, 2) + m[1] * tform.at<double>(1, 2));
+			m[5] = -(m[3] * tform.at<double>(0, 2) + m[4] * tform.at<double>(1, 2));
+
+			int width = size.width;
+			for (int y = 0; y < size.height; ++y) {
+				for (int x = 0; x < width; ++x) {
+					float sx = static_cast<float>(m[0] * x + m[1] * y + m[2]);
+					float sy = static_cast<float>(m[3] * x + m[4] * y + m[5]);
+					int x0 = static_cast<int>(std::floor(sx));
+					int y0 = static_cast<int>(std::floor(sy));
+					float wx = sx - x0, wy = sy - y0;
+					float values[3];
+					if (x0 >= 0 && y0 >= 0 && x0 + 1 < image.cols && y0 + 1 < image.rows) {
+						// all four taps inside the image.
+						const T* p0 = image.ptr<T>(y0) + 3 * x0;
+						const T* p1 = image.ptr<T>(y0 + 1) + 3 * x0;
+						for (int c = 0; c < 3; ++c) {
+							float top = p0[c] + (p0[c + 3] - p0[c]) * wx;
+							float bottom = p1[c] + (p1[c + 3] - p1[c]) * wx;
+							values[c] = top + (bottom - top) * wy;
+						}
+					}
+					else {
+						for (int c = 0; c < 3; ++c) {
+							float top = pixel<T>(image, x0, y0, c) * (1.0f - wx)
+								+ pixel<T>(image, x0 + 1, y0, c) * wx;
+							float bottom = pixel<T>(image, x0, y0 + 1, c) * (1.0f - wx)
+								+ pixel<T>(image, x0 + 1, y0 + 1, c) * wx;
+							values[c] = top + (bottom - top) * wy;
+						}
+					}
+					for (int c = 0; c < 3; ++c) {
+						float value = values[c] * alpha + beta;
+						dst.data[c * dst.plane_step + y * dst.row_step + x] = value;
+						if (mirrored)
+							mirrored->data[c * mirrored->plane_step + y * mirrored->row_step
+								+ width - 1 - x] = value;
+					}
+				}
+			}
+		}
+
+	} // namespace
+
+	void ResizeToPlanar(const cv::Mat& image, const cv::Rect& region, const cv::Size& size,
+		Planar dst, float alpha, float beta, const Planar* mirrored) {
+		if (region.width <= 0 || region.height <= 0 || size.width <= 0 || size.height <= 0)
+			throw std::invalid_argument("empty region or size to resize.");
+		if (image.type() == CV_8UC3)
+			resizeToPlanar<uchar>(image, region, size, dst, alpha, beta, mirrored);
+		else if (image.type() == CV_32FC3)
+			resizeToPlanar<float>(image, region, size, dst, alpha, beta, mirrored);
+		else
+			throw std::invalid_argument("unsupported image type to resize.");
+	}
+
+	void WarpToPlanar(const cv::Mat& image, const cv::Mat& tform, const cv::Size& size,
+		Planar dst, float alpha, float beta, const Planar* mirrored) {
+		if (size.width <= 0 || size.height <= 0)
+			throw std::invalid_argument("empty size to warp.");
+		if (tform.rows != 2 || tform.cols != 3 || tform.type() != CV_64F)
+			throw std::invalid_argument("warp needs a 2x3 double transform.");
+		if (image.type() == CV_8UC3)
+			warpToPlanar<uchar>(image, tform, size, dst, alpha, beta, mirrored);
+		else if (image.type() == CV_32FC3)
+			warpToPlanar<float>(image, tform, size, dst, alpha, beta, mirrored);
+		else
+			throw std::invalid_argument("unsupported image type to warp.");
+	}
+
+} // ocean_ai
@@ -0,0 +1,48 @@
+#ifndef OCEAN_AI_PREPROCESS_HPP_
+#define OCEAN_AI_PREPROCESS_HPP_
+
+#include "common.hpp"
+
+namespace ocean_ai {
+
+	// Normalization of network inputs: [0,255] -> [-1, 1]
+	const float kNormAlpha = 0.0078125f;
+	const float kNormBeta = -127.5f * 0.0078125f;
+
+	/* Planar float destination, eg. one image slot of a caffe input blob.
+	 * Steps are counted in floats.
+	 */
+	struct Planar {
+		float* data;
+		int row_step;	// between rows of a plane
+		int plane_step;	// between channel planes
+
+		Planar(float* data, const cv::Size& size)
+			: data(data), row_step(size.width), plane_step(size.area()) {}
+		Planar(float* data, int row_step, int plane_step)
+			: data(data), row_step(row_step), plane_step(plane_step) {}
+	};
+
+	/* Resize 'region' of a BGR image (CV_8UC3 or CV_32FC3) bilinearly to 'size',
+	 * normalize as x * alpha + beta and write channel planes to 'dst' in one pass.
+	 * Sampling matches cv::resize of the region cropped with zero padding:
+	 * pixels of 'region' outside the image read as 0.
+	 * The horizontally flipped result goes to 'mirrored' too if given.
+	 * Blending runs with AVX2 or SSE2, picked by the features of the running CPU.
+	 */
+	void ResizeToPlanar(const cv::Mat& image, const cv::Rect& region, const cv::Size& size,
+		Planar dst, float alpha = kNormAlpha, float beta = kNormBeta,
+		const Planar* mirrored = nullptr);
+
+	/* Warp a BGR image (CV_8UC3 or CV_32FC3) by the 2x3 affine 'tform' to 'size',
+	 * normalize as x * alpha + beta and write channel planes to 'dst' in one pass,
+	 * and the horizontally flipped face to 'mirrored' if given.
+	 * Sampling matches cv::warpAffine, bilinear with a zero constant border.
+	 */
+	void WarpToPlanar(const cv::Mat& image, const cv::Mat& tform, const cv::Size& size,
+		Planar dst, float alpha = kNormAlpha, float beta = kNormBeta,
+		const Planar* mirrored = nullptr);
+
+} // ocean_ai
+
+#endif // OCEAN_AI_PREPROCESS_HPP_
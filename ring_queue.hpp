@@ -0,0 +1,207 @@
+#ifndef OCEAN_AI_RING_QUEUE_HPP_
+#define OCEAN_AI_RING_QUEUE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace ocean_ai {
+
+	/* Counters of a RingQueue, wait time is summed over blocking pops only. */
+	struct QueueStats
+	{
+		uint64_t pops;			// successful pops (context acquisitions)
+		uint64_t waits;			// pops that did not succeed immediately
+		uint64_t wait_ns;		// total time spent waiting in Pop
+		int max_waiters;		// high-water mark of blocked pops
+	};
+
+	/* A bounded lock-free MPMC queue (Dmitry Vyukov's ring of sequenced cells).
+	 * Pop spins briefly on an empty queue before it blocks on a condition
+	 * variable, which pushes only touch when somebody is blocked.
+	 */
+	template <typename T>
+	class RingQueue
+	{
+		static const int kSpins = 128;
+
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		explicit RingQueue(size_t capacity = 1024)
+			: enqueue_pos_(0), dequeue_pos_(0), waiters_(0),
+			pops_(0), waits_(0), wait_ns_(0), max_waiters_(0)
+		{
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			mask_ = size - 1;
+			cells_.reset(new Cell[size]);
+			for (size_t i = 0; i < size; ++i)
+				cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		bool TryPush(T& value)
+		{
+			size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+			Cell* cell;
+			while (true) {
+				cell = &cells_[pos & mask_];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;	// full
+				else
+					pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+			cell->value = std::move(value);
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool TryPop(T& value)
+		{
+			size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+			Cell* cell;
+			while (true) {
+				cell = &cells_[pos & mask_];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+				if (diff == 0) {
+					if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;	// empty
+				else
+					pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+			value = std::move(cell->value);
+			cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+			return true;
+		}
+
+		void Push(T value)
+		{
+			while (!TryPush(value))
+				std::this_thread::yield();
+			// pairs with the fence in Pop: either we see the waiter or it sees the value.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiters_.load(std::memory_order_relaxed) > 0) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				cond_.notify_one();
+			}
+		}
+
+		T Pop()
+		{
+			T value;
+			PopUntil(value, Clock::time_point::max());
+			return value;
+		}
+
+		/* Pop a value unless the queue stays empty until 'deadline'. */
+		bool PopUntil(T& value, Clock::time_point deadline)
+		{
+			if (TryPop(value)) {
+				pops_.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			Clock::time_point start = Clock::now();
+			bool done = false;
+			for (int i = 0; i < kSpins && !done; ++i) {
+				std::this_thread::yield();
+				done = TryPop(value);
+			}
+			if (!done) {
+				int waiters = waiters_.fetch_add(1, std::memory_order_relaxed) + 1;
+				int max_waiters = max_waiters_.load(std::memory_order_relaxed);
+				while (waiters > max_waiters &&
+					!max_waiters_.compare_exchange_weak(max_waiters, waiters, std::memory_order_relaxed));
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					if (deadline == Clock::time_point::max())
+						cond_.wait(lock, [&] { return done = TryPop(value); });
+					else
+						cond_.wait_until(lock, deadline, [&] { return done = TryPop(value); });
+				}
+				waiters_.fetch_sub(1, std::memory_order_relaxed);
+			}
+
+			auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+			waits_.fetch_add(1, std::memory_order_relaxed);
+			wait_ns_.fetch_add(wait.count(), std::memory_order_relaxed);
+			if (done)
+				pops_.fetch_add(1, std::memory_order_relaxed);
+			return done;
+		}
+
+		/* Pop a value unless the queue stays empty for 'timeout'. */
+		template <typename Rep, typename Period>
+		bool TryPop(T& value, const std::chrono::duration<Rep, Period>& timeout)
+		{
+			return PopUntil(value, Clock::now() + timeout);
+		}
+
+		/* Approximate number of queued values. */
+		size_t Size() const
+		{
+			size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+			size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+
+		size_t Capacity() const
+		{
+			return mask_ + 1;
+		}
+
+		QueueStats Stats() const
+		{
+			QueueStats stats;
+			stats.pops = pops_.load(std::memory_order_relaxed);
+			stats.waits = waits_.load(std::memory_order_relaxed);
+			stats.wait_ns = wait_ns_.load(std::memory_order_relaxed);
+			stats.max_waiters = max_waiters_.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<Cell[]> cells_;
+		size_t mask_;
+		// producers and consumers spin on separate cache lines.
+		char pad0_[64];
+		std::atomic<size_t> enqueue_pos_;
+		char pad1_[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> dequeue_pos_;
+		char pad2_[64 - sizeof(std::atomic<size_t>)];
+
+		std::mutex mutex_;
+		std::condition_variable cond_;
+		std::atomic<int> waiters_;
+
+		std::atomic<uint64_t> pops_;
+		std::atomic<uint64_t> waits_;
+		std::atomic<uint64_t> wait_ns_;
+		std::atomic<int> max_waiters_;
+	};
+
+} // ocean_ai
+
+#endif // OCEAN_AI_RING_QUEUE_HPP_
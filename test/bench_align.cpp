@@ -0,0 +1,82 @@
+#include <iomanip>
+#include <iostream>
+#include "center.hpp"
+#include "mtcnn.hpp"
+
+using namespace std;
+using namespace ocean_ai;
+
+const int kRounds = 50;
+
+// Milliseconds per round of aligning all 'fpts' with 'align'.
+template <typename F>
+double bench(const vector<FPoints>& fpts, F align) {
+  for (int i = 0; i < 3; i++)
+    align();
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; i++)
+    align();
+  auto stop = chrono::steady_clock::now();
+  return chrono::duration_cast<chrono::microseconds>(stop - start).count() / 1000.0 / kRounds;
+}
+
+void report(const string& name, size_t faces, double ms) {
+  cout << setw(24) << name
+       << setw(8) << faces
+       << setw(12) << fixed << setprecision(3) << ms
+       << setw(12) << setprecision(0) << faces * 1000.0 / ms << endl;
+}
+
+int main() {
+  try {
+    Config config("config.json");
+    if (config.settings.device == "cpu") {
+      caffe::Caffe::set_mode(caffe::Caffe::CPU);
+    }
+    else {
+      caffe::Caffe::set_mode(caffe::Caffe::GPU);
+      caffe::Caffe::SetDevice(0);
+    }
+    FLAGS_logtostderr = 1;
+    FLAGS_minloglevel = 2;
+    ::google::InitGoogleLogging("");
+
+    cv::Mat image = cv::imread("test/test2.jpg");
+    Mtcnn mtcnn(config.settings.mtcnn);
+    vector<FPoints> fpts;
+    for (auto& info : mtcnn.detect(image))
+      fpts.push_back(info.fpts);
+    // repeat faces so threads have enough work.
+    while (!fpts.empty() && fpts.size() < 64)
+      fpts.insert(fpts.end(), fpts.begin(), fpts.end());
+
+    const FPoints& ref_points = config.settings.center.ref_points;
+    Aligner aligner(ref_points, cv::Size(96, 112));
+    cout << "                  method   faces     ms/call     faces/s" << endl;
+
+    // the previous estimator: full affine, similarity as fallback.
+    report("estimateRigidTransform", fpts.size(), bench(fpts, [&] {
+      for (auto& fpt : fpts) {
+        cv::Mat face;
+        cv::Mat tform = cv::estimateRigidTransform(fpt, ref_points, true);
+        if (tform.empty())
+          tform = cv::estimateRigidTransform(fpt, ref_points, false);
+        cv::warpAffine(image, face, tform, aligner.size());
+      }
+    }));
+    report("closed-form", fpts.size(), bench(fpts, [&] {
+      aligner.alignMany(image, fpts);
+    }));
+    for (int threads : {2, 4}) {
+      ThreadPool workers(threads - 1);
+      report("closed-form x" + to_string(threads), fpts.size(), bench(fpts, [&] {
+        aligner.alignMany(image, fpts, &workers);
+      }));
+    }
+  }
+  catch (const std::exception& ex) {
+    cout << "exception: " << ex.what() << endl;
+    return 1;
+  }
+  return 0;
+}
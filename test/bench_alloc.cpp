@@ -0,0 +1,120 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include "mtcnn.hpp"
+
+using namespace std;
+using namespace ocean_ai;
+
+// Heap allocations at the malloc level: operator new, cv::fastMalloc of
+// cv::Mat buffers and malloc of caffe blobs in CPU mode all end up here.
+// Pinned host memory of caffe in GPU mode (cudaMallocHost) is not counted.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+}
+
+static atomic<size_t> allocations(0);
+static atomic<size_t> allocated_bytes(0);
+
+static void count(size_t size) {
+  allocations.fetch_add(1, memory_order_relaxed);
+  allocated_bytes.fetch_add(size, memory_order_relaxed);
+}
+
+extern "C" {
+void* malloc(size_t size) {
+  count(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) {
+  count(num * size);
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* p, size_t size) {
+  count(size);
+  return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  count(size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  count(size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size) {
+  count(size);
+  *p = __libc_memalign(alignment, size);
+  return *p ? 0 : ENOMEM;
+}
+
+void free(void* p) {
+  __libc_free(p);
+}
+}
+
+const int kRounds = 20;
+
+// Allocations and time per detect() after warming up nets and buffers.
+void bench(const Config::Settings::Mtcnn& c_mtcnn, const cv::Mat& image) {
+  Mtcnn mtcnn(c_mtcnn);
+  size_t faces = 0;
+  for (int i = 0; i < 3; i++)
+    faces = mtcnn.detect(image).size();
+
+  size_t before = allocations.load();
+  size_t before_bytes = allocated_bytes.load();
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; i++)
+    mtcnn.detect(image);
+  auto stop = chrono::steady_clock::now();
+  size_t count = allocations.load() - before;
+  size_t bytes = allocated_bytes.load() - before_bytes;
+
+  double ms = chrono::duration_cast<chrono::microseconds>(stop - start).count() / 1000.0;
+  cout << setw(9) << c_mtcnn.pyramid
+       << setw(8) << faces
+       << setw(14) << count / kRounds
+       << setw(14) << bytes / kRounds / 1024
+       << setw(12) << fixed << setprecision(2) << ms / kRounds << endl;
+}
+
+int main() {
+  try {
+    Config config("config.json");
+    if (config.settings.device == "cpu") {
+      caffe::Caffe::set_mode(caffe::Caffe::CPU);
+    }
+    else {
+      caffe::Caffe::set_mode(caffe::Caffe::GPU);
+      caffe::Caffe::SetDevice(0);
+    }
+    FLAGS_logtostderr = 1;
+    FLAGS_minloglevel = 2;
+    ::google::InitGoogleLogging("");
+
+    cv::Mat image = cv::imread("test/test2.jpg");
+    cout << "  pyramid   faces    allocs/det    KB/det      ms/det" << endl;
+    Config::Settings::Mtcnn c_mtcnn = config.settings.mtcnn;
+    for (const char* pyramid : {"serial", "mosaic", "parallel"}) {
+      c_mtcnn.pyramid = pyramid;
+      bench(c_mtcnn, image);
+    }
+  }
+  catch (const std::exception& ex) {
+    cout << "exception: " << ex.what() << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "nms.hpp"
+
+using namespace std;
+using namespace ocean_ai;
+
+// Candidates of one P-Net scale: 12/scale sized boxes jittered around faces.
+BoxBuffer candidates(int num, mt19937& rng) {
+  uniform_real_distribution<float> center(0.0f, 1920.0f);
+  normal_distribution<float> jitter(0.0f, 6.0f);
+  uniform_real_distribution<float> score(0.5f, 1.0f);
+  const float size = 40.0f;
+  const int per_face = 16;
+
+  BoxBuffer boxes;
+  boxes.reserve(num);
+  float cx = 0, cy = 0;
+  for (int i = 0; i < num; i++) {
+    if (i % per_face == 0) {
+      cx = center(rng);
+      cy = center(rng) * 0.5625f;
+    }
+    float x = cx + jitter(rng), y = cy + jitter(rng);
+    boxes.push_back(BBox(x, y, x + size, y + size), score(rng));
+  }
+  return boxes;
+}
+
+// Tiny boxes far apart on a single row, the grid must not get one cell per pixel.
+BoxBuffer row(int num, mt19937& rng) {
+  uniform_real_distribution<float> x(0.0f, 1e7f);
+  uniform_real_distribution<float> score(0.5f, 1.0f);
+  BoxBuffer boxes;
+  boxes.reserve(num);
+  for (int i = 0; i < num; i++) {
+    float x1 = x(rng);
+    boxes.push_back(BBox(x1, 100.0f, x1 + 2.0f, 102.0f), score(rng));
+  }
+  return boxes;
+}
+
+// The former erase-based NMS of Mtcnn, as reference.
+vector<int> legacy(const BoxBuffer& boxes, float threshold) {
+  vector<int> pros(boxes.size());
+  for (size_t i = 0; i < pros.size(); i++)
+    pros[i] = i;
+  stable_sort(pros.begin(), pros.end(), [&](int x, int y) { return boxes.scores[x] > boxes.scores[y]; });
+
+  vector<int> keep;
+  while (!pros.empty()) {
+    int max = pros[0];
+    pros.erase(pros.begin());
+    float max_area = (boxes.x2[max] - boxes.x1[max]) * (boxes.y2[max] - boxes.y1[max]);
+    size_t idx = 0;
+    while (idx < pros.size()) {
+      int k = pros[idx];
+      float x1 = std::max(boxes.x1[max], boxes.x1[k]);
+      float y1 = std::max(boxes.y1[max], boxes.y1[k]);
+      float x2 = std::min(boxes.x2[max], boxes.x2[k]);
+      float y2 = std::min(boxes.y2[max], boxes.y2[k]);
+      float overlap = 0;
+      if (x1 < x2 && y1 < y2) {
+        float inter = (x2 - x1) * (y2 - y1);
+        float area = (boxes.x2[k] - boxes.x1[k]) * (boxes.y2[k] - boxes.y1[k]);
+        overlap = inter / (max_area + area - inter);
+      }
+      if (overlap > threshold)
+        pros.erase(pros.begin() + idx);
+      else
+        idx++;
+    }
+    keep.push_back(max);
+  }
+  return keep;
+}
+
+template <typename F>
+double bench(F nms, const BoxBuffer& boxes, size_t& kept) {
+  const int rounds = 3;
+  auto start = chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    kept = nms(boxes, 0.5f).size();
+  auto stop = chrono::steady_clock::now();
+  return chrono::duration_cast<chrono::microseconds>(stop - start).count() / 1000.0 / rounds;
+}
+
+int main() {
+  mt19937 rng(7);
+  cout << "  boxes    legacy(ms)    soa(ms)    grid(ms)    kept" << endl;
+  for (int num : {1000, 10000, 100000}) {
+    BoxBuffer boxes = candidates(num, rng);
+    size_t kept_legacy = 0, kept_soa = 0, kept_grid = 0;
+    // the quadratic erase loop takes minutes on 100k boxes.
+    double t_legacy = num <= 10000 ? bench(legacy, boxes, kept_legacy) : -1.0;
+    double t_soa = bench(NonMaximumSuppression<kIoU>, boxes, kept_soa);
+    double t_grid = bench(GridNonMaximumSuppression<kIoU>, boxes, kept_grid);
+    cout << setw(7) << num
+         << setw(14) << fixed << setprecision(2) << t_legacy
+         << setw(11) << t_soa
+         << setw(12) << t_grid
+         << setw(8) << kept_soa;
+    if (kept_soa != kept_grid || (num <= 10000 && kept_soa != kept_legacy))
+      cout << "  MISMATCH";
+    cout << endl;
+  }
+
+  BoxBuffer boxes = row(10000, rng);
+  size_t kept_soa = 0, kept_grid = 0;
+  double t_soa = bench(NonMaximumSuppression<kIoU>, boxes, kept_soa);
+  double t_grid = bench(GridNonMaximumSuppression<kIoU>, boxes, kept_grid);
+  cout << "    row" << setw(14) << -1.0
+       << setw(11) << t_soa
+       << setw(12) << t_grid
+       << setw(8) << kept_soa;
+  if (kept_soa != kept_grid)
+    cout << "  MISMATCH";
+  cout << endl;
+  return 0;
+}
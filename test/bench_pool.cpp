@@ -0,0 +1,57 @@
+#include <iomanip>
+#include <iostream>
+#include "context.hpp"
+
+using namespace std;
+using namespace ocean_ai;
+
+// Number of pooled items, as contexts of a node.
+const int kItems = 4;
+// Acquisitions done by every thread.
+const int kRounds = 20000;
+
+// Acquire and release an item like ScopedContext, with a little work inside.
+template <typename Pool>
+double bench(Pool& pool, int threads) {
+  for (int i = 0; i < kItems; i++)
+    pool.Push(unique_ptr<int>(new int(i)));
+
+  auto start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&pool] {
+      for (int r = 0; r < kRounds; r++) {
+        unique_ptr<int> item = pool.Pop();
+        volatile int sum = 0;
+        for (int i = 0; i < 64; i++)
+          sum += *item;
+        pool.Push(move(item));
+      }
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  auto stop = chrono::steady_clock::now();
+
+  for (int i = 0; i < kItems; i++)
+    pool.Pop();
+  double ns = chrono::duration_cast<chrono::nanoseconds>(stop - start).count();
+  return ns / (threads * kRounds);
+}
+
+int main() {
+  cout << "threads    queue(ns/op)    ring(ns/op)    ring waits    max waiters" << endl;
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    Queue<unique_ptr<int> > queue;
+    RingQueue<unique_ptr<int> > ring(kItems);
+    double t_queue = bench(queue, threads);
+    double t_ring = bench(ring, threads);
+    QueueStats stats = ring.Stats();
+    cout << setw(7) << threads
+         << setw(16) << fixed << setprecision(1) << t_queue
+         << setw(15) << t_ring
+         << setw(14) << stats.waits
+         << setw(15) << stats.max_waiters << endl;
+  }
+  return 0;
+}
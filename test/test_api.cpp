@@ -34,6 +34,22 @@ int main() {
   vector<FaceInfo> infos0 = FaceDetect(image0);
   timer.Toc();
   cout << "detect " << infos0.size() << " use: " << timer.Elasped() << "ms" << endl;
+  timer.Tic();
+  vector<FaceInfo> largest = FaceDetect(image0, DetectOptions::Largest());
+  timer.Toc();
+  cout << "detect largest " << largest.size() << " use: " << timer.Elasped() << "ms" << endl;
+  vector<Rect> rois;
+  for (auto& info : infos0)
+    rois.push_back(Rect(Point2f(info.bbox[0], info.bbox[1]), Point2f(info.bbox[2], info.bbox[3])));
+  timer.Tic();
+  vector<FaceInfo> in_rois = FaceDetect(image0, rois);
+  timer.Toc();
+  cout << "detect " << in_rois.size() << " in rois use: " << timer.Elasped() << "ms" << endl;
+  vector<Mat> batch = {image0, image0, image0, image0};
+  timer.Tic();
+  vector<vector<FaceInfo> > batch_infos = FaceDetectBatch(batch);
+  timer.Toc();
+  cout << "detect batch of " << batch_infos.size() << " use: " << timer.Elasped() << "ms" << endl;
   imdraw(image0, infos0);
   imwrite("build/detect.jpg", image0);
   // face verify
@@ -63,5 +79,41 @@ int main() {
   cout << "extract use: " << timer.Elasped() << "ms" << endl;
   cout << "features shape: " << features.rows << " x " << features.cols << endl; 
 
+  // asynchronous face detect
+  timer.Tic();
+  vector<future<vector<FaceInfo> > > results;
+  for (int i = 0; i < 8; i++)
+    results.push_back(FaceDetectAsync(image0));
+  for (auto& result : results)
+    result.get();
+  timer.Toc();
+  cout << "async detect x8 use: " << timer.Elasped() << "ms" << endl;
+
+  // multi-image extraction, pipelined if enabled
+  vector<Mat> images = {image1, image2, image3, image1, image2, image3};
+  timer.Tic();
+  vector<Mat> image_features = FaceExtractImages(images);
+  timer.Toc();
+  cout << "extract " << images.size() << " images use: " << timer.Elasped() << "ms" << endl;
+
+  // stream detection, tracking faces of the last frame
+  FaceStream stream;
+  timer.Tic();
+  for (int i = 0; i < 30; i++)
+    stream.Detect(image0);
+  timer.Toc();
+  cout << "stream detect x30 use: " << timer.Elasped() << "ms" << endl;
+
+  // hot reload while requests are in flight
+  results.clear();
+  for (int i = 0; i < 8; i++)
+    results.push_back(FaceDetectAsync(image0));
+  timer.Tic();
+  bool reloaded = ReloadEngine("config.json");
+  timer.Toc();
+  for (auto& result : results)
+    result.get();
+  cout << "reload " << (reloaded ? "ok" : "failed") << " use: " << timer.Elasped() << "ms" << endl;
+
   return 0;
 }
\ No newline at end of file
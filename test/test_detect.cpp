@@ -49,8 +49,6 @@ int main() {
 		else
 			sample = img;
 
-		sample.convertTo(sample, CV_32FC3);
-
 		vector<FaceInfo> infos;
 
 		for (int i = 0; i < 20; i++) {
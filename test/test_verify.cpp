@@ -15,7 +15,6 @@ Mat imread(const char* filename) {
 		cv::cvtColor(img, sample, cv::COLOR_RGBA2BGR);
 	else
 		sample = img;
-	sample.convertTo(sample, CV_32FC3);
 
 	return R(sample);
 }
@@ -0,0 +1,60 @@
+#ifndef OCEAN_AI_THREAD_POOL_HPP_
+#define OCEAN_AI_THREAD_POOL_HPP_
+
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "context.hpp"
+
+namespace ocean_ai {
+
+	/* A fixed size pool of worker threads fed by a Queue of tasks. */
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool(int threads)
+		{
+			for (int i = 0; i < threads; ++i)
+				threads_.emplace_back(&ThreadPool::Run, this);
+		}
+
+		~ThreadPool()
+		{
+			// an empty task stops one worker after the queued tasks are done.
+			for (size_t i = 0; i < threads_.size(); ++i)
+				tasks_.Push(std::function<void()>());
+			for (auto& thread : threads_)
+				thread.join();
+		}
+
+		template <typename F>
+		auto Submit(F f) -> std::future<decltype(f())>
+		{
+			using Result = decltype(f());
+			auto task = std::make_shared<std::packaged_task<Result()> >(std::move(f));
+			std::future<Result> result = task->get_future();
+			tasks_.Push([task] { (*task)(); });
+			return result;
+		}
+
+		size_t Size() const
+		{
+			return threads_.size();
+		}
+
+	private:
+		void Run()
+		{
+			while (std::function<void()> task = tasks_.Pop())
+				task();
+		}
+
+		Queue<std::function<void()> > tasks_;
+		std::vector<std::thread> threads_;
+	};
+
+} // ocean_ai
+
+#endif // OCEAN_AI_THREAD_POOL_HPP_